@@ -9,11 +9,18 @@
  * Contains basic instructions for how to use this program.
  */
 inline constexpr const char* const usage_str = R"(
-usage: ploy [-h|--help] [-d|--disassemble] <file>
+usage: ploy [-h|--help] [-d|--disassemble] [--no-cache] [--compile-to <out>] <file>
 
 -h|--help           Display this message and quit.
 -d|--disassemble    Print disassembly in addition to program output.
-<file>              The file path of the scheme program to execute.)";
+--no-cache          Don't read or write the bytecode cache.
+--compile-to <out>  Write the compiled bytecode of the program to the given file path instead of
+                    executing the program. The bytecode file can then be executed in place of the
+                    program.
+<file>              The file path of the scheme program (or compiled bytecode file) to execute.
+
+Compiled bytecode is cached by the contents of the program in $PLOY_CACHE_DIR, or else in
+$XDG_CACHE_HOME/ploy or ~/.cache/ploy.)";
 
 /**
  * Exception type for anything cli arg related. Will combine the given what message with the usage
@@ -42,6 +49,16 @@ struct arg_parser {
      */
     bool disassemble = false;
 
+    /**
+     * If true indicates to neither read nor write the bytecode cache.
+     */
+    bool no_cache = false;
+
+    /**
+     * If non-null, the file path to write the compiled program's bytecode to instead of running it.
+     */
+    const char* compile_to_path = nullptr;
+
     /**
      * File path to run.
      */
@@ -71,7 +88,14 @@ struct arg_parser {
 
             if (is_flag(arg, "-d", "--disassemble"))
                 disassemble = true;
-            else if (file_path)
+            else if (!strcmp(arg, "--no-cache"))
+                no_cache = true;
+            else if (!strcmp(arg, "--compile-to")) {
+                if (++i == argc)
+                    throw arg_error("--compile-to requires a file path");
+
+                compile_to_path = argv[i];
+            } else if (file_path)
                 throw arg_error(std::format("unexpected arg: {}", arg));
             else
                 file_path = arg;
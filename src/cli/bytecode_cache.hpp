@@ -0,0 +1,108 @@
+#pragma once
+
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <optional>
+#include <random>
+#include <span>
+#include <stdexcept>
+#include <stdint.h>
+#include <stdlib.h>
+#include <system_error>
+
+#include "bytecode.hpp"
+#include "mapped_file.hpp"
+
+/**
+ * Returns the value of the given environment variable, or nullptr if it isn't set or is empty.
+ */
+inline const char* get_env(const char* const name) {
+#ifdef _MSC_VER
+#pragma warning(suppress: 4996)
+#endif
+    const char* const value = getenv(name);
+    return value and *value ? value : nullptr;
+}
+
+/**
+ * Returns the directory that compiled programs are cached in, or nothing if there's nowhere to
+ * cache them.
+ */
+inline std::optional<std::filesystem::path> get_cache_dir() {
+    if (const char* const dir = get_env("PLOY_CACHE_DIR"))
+        return dir;
+
+    if (const char* const dir = get_env("XDG_CACHE_HOME"))
+        return std::filesystem::path{dir} / "ploy";
+
+#ifdef _WIN32
+    if (const char* const dir = get_env("LOCALAPPDATA"))
+        return std::filesystem::path{dir} / "ploy";
+#else
+    if (const char* const dir = get_env("HOME"))
+        return std::filesystem::path{dir} / ".cache" / "ploy";
+#endif
+
+    return std::nullopt;
+}
+
+/**
+ * Returns the path of the cached bytecode of the program with the given source in the given cache
+ * dir. Since the file is named after the hash of the source, editing a program never hits a stale
+ * cache entry, and the same program is only compiled once no matter where it's run from.
+ */
+inline std::filesystem::path get_cache_path(
+    const std::filesystem::path& cache_dir,
+    const std::span<const uint8_t> source
+) {
+    return cache_dir / std::format("{:016x}-{:x}.ployc", bytecode::hash(source), source.size());
+}
+
+/**
+ * Loads the bytecode at the given cache path. Returns nothing if there's no usable bytecode there,
+ * e.g. if it was written by an incompatible version of ploy.
+ */
+inline std::optional<bytecode> load_cached_bytecode(const std::filesystem::path& cache_path) {
+    std::error_code ec;
+    if (!std::filesystem::exists(cache_path, ec))
+        return std::nullopt;
+
+    try {
+        const mapped_file file{cache_path.string().c_str()};
+        return bytecode::deserialize(file.bytes());
+    } catch (const std::exception&) {
+        return std::nullopt;
+    }
+}
+
+/**
+ * Writes the given bytes to the file at the given path, replacing the file if it exists.
+ */
+inline void write_file(const std::filesystem::path& file_path, const std::span<const uint8_t> bytes) {
+    std::ofstream f(file_path, std::ios::binary | std::ios::trunc);
+    f.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+    f.close();
+
+    if (!f)
+        throw std::runtime_error(std::format("couldn't write file: {}", file_path.string()));
+}
+
+/**
+ * Writes the given serialized bytecode to the given cache path. Caching is best effort, so errors
+ * are ignored. The bytecode is written to a temporary file first and then renamed into place, so
+ * concurrent runs of the same program never see a partially written cache entry.
+ */
+inline void cache_bytecode(const std::filesystem::path& cache_path, const std::span<const uint8_t> bytes) {
+    std::filesystem::path temp_path = cache_path;
+    temp_path += std::format(".{:x}.tmp", std::random_device{}());
+
+    try {
+        std::filesystem::create_directories(cache_path.parent_path());
+        write_file(temp_path, bytes);
+        std::filesystem::rename(temp_path, cache_path);
+    } catch (const std::exception&) {
+        std::error_code ec;
+        std::filesystem::remove(temp_path, ec);
+    }
+}
@@ -1,27 +1,49 @@
 #include <array>
 #include <format>
-#include <fstream>
+#include <optional>
 #include <print>
 #include <exception>
 
 #include "arg_parser.hpp"
+#include "bytecode_cache.hpp"
 #include "compiler.hpp"
+#include "mapped_file.hpp"
 #include "tokenizer.hpp"
 #include "virtual_machine.hpp"
 
 /**
- * Reads the file at the given file path into a string.
+ * Compiles the given scheme source.
  */
-std::string file_to_string(const char* const file_path) {
-    std::ifstream f(file_path);
-    f.seekg(0, std::ios::end);
-    size_t file_size = f.tellg();
-    f.seekg(0);
+bytecode compile(const std::span<const uint8_t> source_bytes) {
+    tokenizer t{{reinterpret_cast<const char*>(source_bytes.data()), source_bytes.size()}};
+    compiler c{t};
 
-    std::string str(file_size, 0);
-    f.read(str.data(), file_size);
+    return std::move(c.program);
+}
+
+/**
+ * Returns the bytecode of the program in the given file, which is either scheme source or a
+ * compiled bytecode file. Compiled source is cached unless caching is disabled, and the cached
+ * bytecode is loaded instead of compiling the source again on later runs.
+ */
+bytecode load_program(const mapped_file& file, const bool use_cache) {
+    const auto bytes = file.bytes();
+
+    if (bytecode::is_serialized(bytes))
+        return bytecode::deserialize(bytes);
+
+    const auto cache_dir = use_cache ? get_cache_dir() : std::nullopt;
+    if (!cache_dir)
+        return compile(bytes);
 
-    return str;
+    const auto cache_path = get_cache_path(*cache_dir, bytes);
+    if (auto cached_program = load_cached_bytecode(cache_path))
+        return std::move(*cached_program);
+
+    bytecode program = compile(bytes);
+    cache_bytecode(cache_path, program.serialize());
+
+    return program;
 }
 
 int main(int argc, char** argv) {
@@ -33,16 +55,21 @@ int main(int argc, char** argv) {
             return 0;
         }
 
-        const std::string source = file_to_string(args.file_path);
+        const mapped_file file{args.file_path};
+
+        if (args.compile_to_path) {
+            const bytecode program = load_program(file, false);
+            write_file(args.compile_to_path, program.serialize());
+            return 0;
+        }
 
-        const tokenizer t{source.c_str()};
-        const compiler c{t.tokens};
+        const bytecode program = load_program(file, !args.no_cache);
 
         if (args.disassemble)
-            std::print("disassembly:\n{}program output:\n", c.program.disassemble());
+            std::print("disassembly:\n{}program output:\n", program.disassemble());
 
         virtual_machine vm;
-        vm.execute(c.program);
+        vm.execute(program);
     } catch (std::exception& e) {
         std::print("error: {}\n", e.what());
         return 1;
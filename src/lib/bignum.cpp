@@ -0,0 +1,290 @@
+#include <algorithm>
+#include <span>
+#include <stdexcept>
+#include <utility>
+
+#include "bignum.hpp"
+
+using limb_vector = std::vector<uint32_t>;
+using limb_span = std::span<const uint32_t>;
+
+/**
+ * Operand length in limbs below which schoolbook multiplication beats Karatsuba.
+ */
+static constexpr size_t karatsuba_threshold = 32;
+
+/**
+ * Removes the most significant zero limbs from the given magnitude.
+ */
+static void trim(limb_vector& v) {
+    while (!v.empty() and v.back() == 0)
+        v.pop_back();
+}
+
+static std::strong_ordering compare_magnitudes(const limb_span a, const limb_span b) {
+    if (a.size() != b.size())
+        return a.size() <=> b.size();
+
+    for (size_t i = a.size(); i-- > 0;)
+        if (a[i] != b[i])
+            return a[i] <=> b[i];
+
+    return std::strong_ordering::equal;
+}
+
+static limb_vector add_magnitudes(limb_span a, limb_span b) {
+    if (a.size() < b.size())
+        std::swap(a, b);
+
+    limb_vector result(a.size() + 1);
+    uint64_t carry = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        const uint64_t sum = uint64_t{a[i]} + (i < b.size() ? b[i] : 0) + carry;
+        result[i] = static_cast<uint32_t>(sum);
+        carry = sum >> 32;
+    }
+    result[a.size()] = static_cast<uint32_t>(carry);
+
+    trim(result);
+    return result;
+}
+
+/**
+ * Subtracts b from a in place. The magnitude of a must be at least that of b.
+ */
+static void subtract_from(limb_vector& a, const limb_span b) {
+    int64_t borrow = 0;
+    for (size_t i = 0; i < a.size() and (i < b.size() or borrow); i++) {
+        const int64_t difference = int64_t{a[i]} - (i < b.size() ? b[i] : 0) - borrow;
+        a[i] = static_cast<uint32_t>(difference);
+        borrow = difference < 0;
+    }
+
+    trim(a);
+}
+
+/**
+ * Adds b, shifted up by the given number of limbs, to a in place. a must be long enough to hold the
+ * sum.
+ */
+static void add_into(limb_vector& a, const limb_span b, const size_t shift) {
+    uint64_t carry = 0;
+    for (size_t i = 0; shift + i < a.size() and (i < b.size() or carry); i++) {
+        const uint64_t sum = uint64_t{a[shift + i]} + (i < b.size() ? b[i] : 0) + carry;
+        a[shift + i] = static_cast<uint32_t>(sum);
+        carry = sum >> 32;
+    }
+}
+
+static limb_vector multiply_schoolbook(const limb_span a, const limb_span b) {
+    limb_vector result(a.size() + b.size());
+
+    for (size_t i = 0; i < a.size(); i++) {
+        uint64_t carry = 0;
+        for (size_t j = 0; j < b.size(); j++) {
+            const uint64_t product = uint64_t{a[i]} * b[j] + result[i + j] + carry;
+            result[i + j] = static_cast<uint32_t>(product);
+            carry = product >> 32;
+        }
+        result[i + b.size()] = static_cast<uint32_t>(carry);
+    }
+
+    trim(result);
+    return result;
+}
+
+static limb_vector multiply_magnitudes(limb_span a, limb_span b) {
+    if (a.size() < b.size())
+        std::swap(a, b);
+
+    if (b.size() < karatsuba_threshold)
+        return multiply_schoolbook(a, b);
+
+    limb_vector result(a.size() + b.size());
+
+    if (2 * b.size() <= a.size()) {
+        // Karatsuba needs operands of similar length, so multiply b by b-sized pieces of a instead.
+        for (size_t i = 0; i < a.size(); i += b.size())
+            add_into(result, multiply_magnitudes(a.subspan(i, std::min(b.size(), a.size() - i)), b), i);
+
+        trim(result);
+        return result;
+    }
+
+    // With a = a1 * B^m + a0 and b = b1 * B^m + b0, the product is
+    // z2 * B^2m + (z1 - z2 - z0) * B^m + z0, where z2 = a1 * b1, z0 = a0 * b0, and
+    // z1 = (a1 + a0) * (b1 + b0). That's three half-sized multiplications instead of four.
+    const size_t m = a.size() / 2;
+    const limb_span a0 = a.first(m);
+    const limb_span a1 = a.subspan(m);
+    const limb_span b0 = b.first(m);
+    const limb_span b1 = b.subspan(m);
+
+    const limb_vector z0 = multiply_magnitudes(a0, b0);
+    const limb_vector z2 = multiply_magnitudes(a1, b1);
+    limb_vector z1 = multiply_magnitudes(add_magnitudes(a0, a1), add_magnitudes(b0, b1));
+    subtract_from(z1, z0);
+    subtract_from(z1, z2);
+
+    add_into(result, z0, 0);
+    add_into(result, z1, m);
+    add_into(result, z2, 2 * m);
+
+    trim(result);
+    return result;
+}
+
+/**
+ * Divides a by the one-limb divisor in place and returns the remainder.
+ */
+static uint32_t divide_by_limb(limb_vector& a, const uint32_t divisor) {
+    uint64_t remainder = 0;
+    for (size_t i = a.size(); i-- > 0;) {
+        const uint64_t dividend = (remainder << 32) | a[i];
+        a[i] = static_cast<uint32_t>(dividend / divisor);
+        remainder = dividend % divisor;
+    }
+
+    trim(a);
+    return static_cast<uint32_t>(remainder);
+}
+
+static limb_vector divide_magnitudes(const limb_span a, const limb_span b) {
+    if (b.size() == 1) {
+        limb_vector quotient{a.begin(), a.end()};
+        divide_by_limb(quotient, b.front());
+        return quotient;
+    }
+
+    // NOTE: plain binary long division. Multi-limb divisors only come up when dividing two bignums,
+    // which isn't worth anything faster yet.
+    limb_vector quotient(a.size());
+    limb_vector remainder;
+    for (size_t bit = a.size() * 32; bit-- > 0;) {
+        // shift the next bit of a into the remainder
+        uint32_t carry = (a[bit / 32] >> (bit % 32)) & 1;
+        for (auto& limb : remainder) {
+            const uint32_t next_carry = limb >> 31;
+            limb = (limb << 1) | carry;
+            carry = next_carry;
+        }
+        if (carry)
+            remainder.emplace_back(carry);
+
+        if (compare_magnitudes(remainder, b) >= 0) {
+            subtract_from(remainder, b);
+            quotient[bit / 32] |= uint32_t{1} << (bit % 32);
+        }
+    }
+
+    trim(quotient);
+    return quotient;
+}
+
+/**
+ * Makes a bignum from a magnitude, normalizing the sign of zero.
+ */
+static bignum make_bignum(limb_vector&& limbs, const bool negative) {
+    bignum result;
+    result.negative = negative and !limbs.empty();
+    result.limbs = std::move(limbs);
+    return result;
+}
+
+bignum::bignum(const int64_t v) : negative{v < 0} {
+    // NOTE: negating in unsigned arithmetic is well defined even for the most negative int64_t.
+    const uint64_t magnitude = negative ? 0 - static_cast<uint64_t>(v) : static_cast<uint64_t>(v);
+
+    limbs = {static_cast<uint32_t>(magnitude), static_cast<uint32_t>(magnitude >> 32)};
+    trim(limbs);
+}
+
+std::optional<int64_t> bignum::to_int64() const {
+    if (limbs.size() > 2)
+        return std::nullopt;
+
+    uint64_t magnitude = 0;
+    for (size_t i = limbs.size(); i-- > 0;)
+        magnitude = (magnitude << 32) | limbs[i];
+
+    constexpr uint64_t max_magnitude = uint64_t{1} << 63;
+    if (magnitude > max_magnitude - !negative)
+        return std::nullopt;
+
+    return negative ? static_cast<int64_t>(0 - magnitude) : static_cast<int64_t>(magnitude);
+}
+
+double bignum::to_double() const {
+    double result = 0;
+    for (size_t i = limbs.size(); i-- > 0;)
+        result = result * 4294967296.0 + limbs[i];
+
+    return negative ? -result : result;
+}
+
+std::string bignum::to_string() const {
+    if (limbs.empty())
+        return "0";
+
+    // peel off base 10^9 digits, least significant first
+    constexpr uint32_t chunk_base = 1'000'000'000;
+    std::vector<uint32_t> chunks;
+    limb_vector magnitude = limbs;
+    while (!magnitude.empty())
+        chunks.emplace_back(divide_by_limb(magnitude, chunk_base));
+
+    std::string str = negative ? "-" : "";
+    str += std::to_string(chunks.back());
+    for (size_t i = chunks.size() - 1; i-- > 0;) {
+        const std::string digits = std::to_string(chunks[i]);
+        str.append(9 - digits.size(), '0');
+        str += digits;
+    }
+
+    return str;
+}
+
+bignum bignum::operator-() const {
+    return make_bignum(limb_vector{limbs}, !negative);
+}
+
+bignum operator+(const bignum& a, const bignum& b) {
+    if (a.negative == b.negative)
+        return make_bignum(add_magnitudes(a.limbs, b.limbs), a.negative);
+
+    // the signs differ, so subtract the smaller magnitude from the larger one
+    if (compare_magnitudes(a.limbs, b.limbs) < 0) {
+        limb_vector limbs = b.limbs;
+        subtract_from(limbs, a.limbs);
+        return make_bignum(std::move(limbs), b.negative);
+    }
+
+    limb_vector limbs = a.limbs;
+    subtract_from(limbs, b.limbs);
+    return make_bignum(std::move(limbs), a.negative);
+}
+
+bignum operator-(const bignum& a, const bignum& b) {
+    return a + (-b);
+}
+
+bignum operator*(const bignum& a, const bignum& b) {
+    return make_bignum(multiply_magnitudes(a.limbs, b.limbs), a.negative != b.negative);
+}
+
+bignum operator/(const bignum& a, const bignum& b) {
+    if (b.limbs.empty())
+        throw std::runtime_error("division by zero");
+
+    if (compare_magnitudes(a.limbs, b.limbs) < 0)
+        return bignum{};
+
+    return make_bignum(divide_magnitudes(a.limbs, b.limbs), a.negative != b.negative);
+}
+
+std::strong_ordering operator<=>(const bignum& a, const bignum& b) {
+    if (a.negative != b.negative)
+        return a.negative ? std::strong_ordering::less : std::strong_ordering::greater;
+
+    return a.negative ? compare_magnitudes(b.limbs, a.limbs) : compare_magnitudes(a.limbs, b.limbs);
+}
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <format>
 #include <limits>
 #include <stdexcept>
@@ -9,8 +10,162 @@
 #include "overload.hpp"
 #include "virtual_machine.hpp"
 
-uint8_t bytecode::add_constant(const scheme_constant& new_constant) {
-    if (constants.size() == std::numeric_limits<uint8_t>::max())
+/**
+ * Version of the serialized bytecode file format. Must be bumped whenever the format, or the
+ * bytecode in a way that isn't covered by bytecode::get_fingerprint, changes incompatibly.
+ */
+static constexpr uint64_t bytecode_file_version = 2;
+
+/**
+ * Identifies the type of a constant in a serialized bytecode file.
+ */
+enum class serialized_constant_kind : uint8_t {
+    boolean,
+    builtin_procedure,
+    empty_list,
+    fixnum,
+    flonum,
+    hand_rolled_procedure,
+    lambda,
+    pair,
+    symbol,
+};
+
+/**
+ * Appends the bytes of the given value to the given serialized bytecode.
+ */
+template <typename T>
+static void append_value(std::vector<uint8_t>& bytes, const T value) {
+    bytes.resize(bytes.size() + sizeof(T));
+    bytecode::write_value<T>(value, bytes.data() + bytes.size() - sizeof(T));
+}
+
+/**
+ * Appends the given name, prefixed with its length, to the given serialized bytecode.
+ */
+static void append_name(std::vector<uint8_t>& bytes, const std::string_view name) {
+    append_value<uint32_t>(bytes, static_cast<uint32_t>(name.size()));
+    bytes.insert(bytes.end(), name.begin(), name.end());
+}
+
+/**
+ * Reads values from serialized bytecode, throwing instead of reading past the end.
+ */
+struct serialized_bytecode_reader {
+    std::span<const uint8_t> bytes;
+
+    std::span<const uint8_t> read_bytes(const size_t count) {
+        if (count > bytes.size())
+            throw std::runtime_error("truncated bytecode file");
+
+        const auto read = bytes.first(count);
+        bytes = bytes.subspan(count);
+        return read;
+    }
+
+    template <typename T>
+    T read_value() {
+        return bytecode::read_value<T>(read_bytes(sizeof(T)).data());
+    }
+
+    std::string_view read_name() {
+        const auto name_bytes = read_bytes(read_value<uint32_t>());
+        return {reinterpret_cast<const char*>(name_bytes.data()), name_bytes.size()};
+    }
+};
+
+/**
+ * Checks that the given code of a serialized bytecode file is made of whole instructions with known
+ * opcodes, that their constant indexes and jump destinations are in bounds, and that it ends with an
+ * instruction that never continues to the next one, so that a corrupt file can't make the vm read
+ * past the code or the constants. Returns which offsets of the code start an instruction.
+ */
+static std::vector<bool> validate_code(const std::span<const uint8_t> code, const size_t constant_count) {
+    const auto invalid_code = [] {
+        return std::runtime_error("invalid code in bytecode file");
+    };
+
+    std::vector<bool> is_instruction_start(code.size());
+    std::vector<size_t> jump_dest_offsets;
+    bool is_last_instruction_final = false;
+
+    for (size_t offset = 0; offset < code.size();) {
+        const uint8_t* const instruction = code.data() + offset;
+        const size_t remaining_size = code.size() - offset;
+
+        const bool is_wide = *instruction == static_cast<uint8_t>(opcode::wide);
+        if (is_wide and remaining_size < 2)
+            throw invalid_code();
+
+        // the opcode the args belong to, which is after the prefix of a wide instruction
+        const uint8_t opcode_value = instruction[is_wide ? 1 : 0];
+        if (opcode_value >= opcode_infos.size())
+            throw invalid_code();
+
+        const auto op = static_cast<opcode>(opcode_value);
+        if (is_wide and op != opcode::make_closure and opcode_infos[opcode_value].size != sizeof(opcode_one_arg))
+            throw invalid_code();
+
+        const auto get_arg = [instruction, is_wide](const size_t i) -> uint32_t {
+            if (is_wide)
+                return bytecode::read_value<wide_arg_type>(instruction + 2 + i * sizeof(wide_arg_type));
+
+            return instruction[1 + i];
+        };
+
+        // make_closure's size depends on its capture count arg, which must be read first
+        if (op == opcode::make_closure and remaining_size < (is_wide ? 2 + 2 * sizeof(wide_arg_type) : 3))
+            throw invalid_code();
+
+        const size_t instruction_size = bytecode::get_instruction_size(instruction);
+        if (instruction_size > remaining_size)
+            throw invalid_code();
+
+        switch (op) {
+            case opcode::push_constant:
+            case opcode::make_closure:
+                if (get_arg(0) >= constant_count)
+                    throw invalid_code();
+                break;
+            case opcode::jump_backward: {
+                const auto jump_size = bytecode::read_value<jump_size_type>(instruction + 1);
+                if (jump_size > offset + 1)
+                    throw invalid_code();
+
+                jump_dest_offsets.emplace_back(offset + 1 - jump_size);
+                break;
+            }
+            case opcode::jump_forward:
+            case opcode::jump_forward_if_not:
+                jump_dest_offsets.emplace_back(offset + 1 + bytecode::read_value<jump_size_type>(instruction + 1));
+                break;
+            default:
+                break;
+        }
+
+        is_instruction_start[offset] = true;
+        offset += instruction_size;
+
+        is_last_instruction_final = !is_wide and (
+            op == opcode::halt
+            or op == opcode::ret
+            or op == opcode::jump_backward
+            or op == opcode::jump_forward
+        );
+    }
+
+    if (!is_last_instruction_final)
+        throw invalid_code();
+
+    for (const size_t dest_offset : jump_dest_offsets)
+        if (dest_offset >= code.size() or !is_instruction_start[dest_offset])
+            throw invalid_code();
+
+    return is_instruction_start;
+}
+
+uint32_t bytecode::add_constant(const scheme_constant& new_constant) {
+    if (constants.size() == std::numeric_limits<uint32_t>::max())
         throw std::runtime_error("exceeded max number of constants allowed");
 
     if (constant_to_index_map.contains(new_constant)) {
@@ -18,7 +173,7 @@ uint8_t bytecode::add_constant(const scheme_constant& new_constant) {
     }
 
     constants.emplace_back(new_constant);
-    const auto i = static_cast<uint8_t>(constants.size() - 1);
+    const auto i = static_cast<uint32_t>(constants.size() - 1);
     constant_to_index_map[new_constant] = i;
     return i;
 }
@@ -42,6 +197,88 @@ void bytecode::append_opcode(opcode value, size_t scope_depth) {
     append_byte(static_cast<uint8_t>(value), scope_depth);
 }
 
+void bytecode::append_opcode(opcode value, uint32_t arg) {
+    if (compiling_blocks.empty())
+        throw std::runtime_error("no blocks to write to");
+
+    append_opcode(value, arg, compiling_blocks.size() - 1);
+}
+
+void bytecode::append_opcode(opcode value, uint32_t arg, size_t scope_depth) {
+    append_opcode(compiling_blocks[scope_depth].code, value, arg);
+}
+
+void bytecode::append_opcode(std::vector<uint8_t>& code, opcode value, uint32_t arg) {
+    if (arg <= std::numeric_limits<uint8_t>::max()) {
+        code.emplace_back(static_cast<uint8_t>(value));
+        code.emplace_back(static_cast<uint8_t>(arg));
+        return;
+    }
+
+    code.emplace_back(static_cast<uint8_t>(opcode::wide));
+    code.emplace_back(static_cast<uint8_t>(value));
+    code.resize(code.size() + sizeof(wide_arg_type));
+    write_value<wide_arg_type>(arg, code.data() + code.size() - sizeof(wide_arg_type));
+}
+
+void bytecode::append_make_closure(
+    uint32_t lambda_constant_index,
+    const std::span<const uint32_t> capture_descriptors
+) {
+    if (compiling_blocks.empty())
+        throw std::runtime_error("no blocks to write to");
+
+    if (capture_descriptors.size() > std::numeric_limits<wide_arg_type>::max())
+        throw std::runtime_error("exceeded max number of captures allowed");
+
+    auto& code = compiling_blocks.back().code;
+    const auto capture_count = static_cast<uint32_t>(capture_descriptors.size());
+
+    const auto fits_byte = [](const uint32_t arg) {
+        return arg <= std::numeric_limits<uint8_t>::max();
+    };
+
+    if (fits_byte(lambda_constant_index) and fits_byte(capture_count) and std::ranges::all_of(capture_descriptors, fits_byte)) {
+        code.emplace_back(static_cast<uint8_t>(opcode::make_closure));
+        code.emplace_back(static_cast<uint8_t>(lambda_constant_index));
+        code.emplace_back(static_cast<uint8_t>(capture_count));
+        for (const auto descriptor : capture_descriptors)
+            code.emplace_back(static_cast<uint8_t>(descriptor));
+
+        return;
+    }
+
+    const auto append_wide_arg = [&code](const wide_arg_type arg) {
+        code.resize(code.size() + sizeof(wide_arg_type));
+        write_value<wide_arg_type>(arg, code.data() + code.size() - sizeof(wide_arg_type));
+    };
+
+    code.emplace_back(static_cast<uint8_t>(opcode::wide));
+    code.emplace_back(static_cast<uint8_t>(opcode::make_closure));
+    append_wide_arg(lambda_constant_index);
+    append_wide_arg(capture_count);
+    for (const auto descriptor : capture_descriptors)
+        append_wide_arg(descriptor);
+}
+
+void bytecode::append_jump_backward(const size_t dest_index) {
+    append_opcode(opcode::jump_backward);
+
+    auto& current_code_block = compiling_blocks.back().code;
+
+    // the vm subtracts the offset from the position of the offset itself
+    const size_t jump_size = current_code_block.size() - dest_index;
+
+    if (jump_size > std::numeric_limits<jump_size_type>::max())
+        throw std::runtime_error("jump size is too large for its type");
+
+    current_code_block.resize(current_code_block.size() + sizeof(jump_size_type));
+    write_value<jump_size_type>(
+        static_cast<jump_size_type>(jump_size),
+        current_code_block.data() + current_code_block.size() - sizeof(jump_size_type)
+    );
+}
+
 void bytecode::backpatch_jump(const size_t backpatch_index) {
     auto& current_code_block = compiling_blocks.back().code;
 
@@ -54,11 +291,8 @@ void bytecode::backpatch_jump(const size_t backpatch_index) {
 }
 
 void bytecode::concat_blocks() {
-    code.emplace_back(static_cast<uint8_t>(opcode::set_coarity_one));
     code.emplace_back(static_cast<uint8_t>(opcode::push_frame_index));
-    code.emplace_back(static_cast<uint8_t>(opcode::push_constant));
-    code.emplace_back(compiled_blocks.back().lambda_constant_id);
-    code.emplace_back(static_cast<uint8_t>(opcode::set_coarity_any));
+    append_opcode(code, opcode::push_constant, compiled_blocks.back().lambda_constant_id);
     code.emplace_back(static_cast<uint8_t>(opcode::call));
     code.emplace_back(static_cast<uint8_t>(opcode::halt));
 
@@ -81,6 +315,103 @@ void bytecode::concat_blocks() {
     compiled_blocks.shrink_to_fit();
 }
 
+bytecode bytecode::deserialize(const std::span<const uint8_t> bytes) {
+    if (!is_serialized(bytes))
+        throw std::runtime_error("not a bytecode file");
+
+    serialized_bytecode_reader reader{bytes};
+    const auto header = reader.read_value<bytecode_file_header>();
+
+    if (header.fingerprint != get_fingerprint())
+        throw std::runtime_error("bytecode file was written by an incompatible version of ploy");
+
+    if (header.constant_count > std::numeric_limits<uint32_t>::max())
+        throw std::runtime_error("exceeded max number of constants allowed");
+
+    bytecode program;
+    program.constants.reserve(header.constant_count);
+
+    for (uint64_t i = 0; i < header.constant_count; i++) {
+        switch (reader.read_value<serialized_constant_kind>()) {
+            case serialized_constant_kind::boolean:
+                program.constants.emplace_back(reader.read_value<uint8_t>() != 0);
+                break;
+            case serialized_constant_kind::builtin_procedure: {
+                const auto it = bp_name_to_ptr.find(reader.read_name());
+                if (it == bp_name_to_ptr.end())
+                    throw std::runtime_error("unknown builtin procedure in bytecode file");
+
+                program.constants.emplace_back(it->second);
+                break;
+            }
+            case serialized_constant_kind::empty_list:
+                program.constants.emplace_back(empty_list{});
+                break;
+            case serialized_constant_kind::fixnum:
+                program.constants.emplace_back(reader.read_value<int64_t>());
+                break;
+            case serialized_constant_kind::flonum:
+                program.constants.emplace_back(reader.read_value<double>());
+                break;
+            case serialized_constant_kind::hand_rolled_procedure: {
+                // NOTE: the name has to be the map's key rather than the file's bytes, since the
+                // constant outlives the file.
+                const auto it = hrp_name_to_code.find(reader.read_name());
+                if (it == hrp_name_to_code.end())
+                    throw std::runtime_error("unknown hand-rolled procedure in bytecode file");
+
+                program.constants.emplace_back(
+                    hand_rolled_procedure_constant{it->first, reader.read_value<uint64_t>()}
+                );
+                break;
+            }
+            case serialized_constant_kind::lambda:
+                program.constants.emplace_back(lambda_constant{reader.read_value<uint64_t>()});
+                break;
+            case serialized_constant_kind::pair: {
+                const auto car_index = reader.read_value<uint32_t>();
+                const auto cdr_index = reader.read_value<uint32_t>();
+
+                // the vm makes constants in order, so a pair can only refer to earlier constants
+                if (car_index >= i or cdr_index >= i)
+                    throw std::runtime_error("pair constant refers to a later constant in bytecode file");
+
+                program.constants.emplace_back(pair_constant{car_index, cdr_index});
+                break;
+            }
+            case serialized_constant_kind::symbol:
+                program.constants.emplace_back(symbol::intern(reader.read_name()));
+                break;
+            default:
+                throw std::runtime_error("invalid constant in bytecode file");
+        }
+    }
+
+    const auto code_bytes = reader.read_bytes(header.code_size);
+    const auto is_instruction_start = validate_code(code_bytes, program.constants.size());
+    program.code.assign(code_bytes.begin(), code_bytes.end());
+
+    for (const auto& c : program.constants) {
+        const overload offset_getter{
+            [](const lambda_constant& v) -> size_t {
+                return v.bytecode_offset;
+            },
+            [](const hand_rolled_procedure_constant& v) -> size_t {
+                return v.bytecode_offset;
+            },
+            [](const auto&) -> size_t {
+                return 0;
+            },
+        };
+
+        const size_t offset = std::visit(offset_getter, c);
+        if (offset >= program.code.size() or !is_instruction_start[offset])
+            throw std::runtime_error("procedure offset out of bounds in bytecode file");
+    }
+
+    return program;
+}
+
 std::string bytecode::disassemble() const {
     std::unordered_map<builtin_procedure, std::string_view> bp_ptr_to_name;
     for (const auto& [k, v] : bp_name_to_ptr)
@@ -94,6 +425,39 @@ std::string bytecode::disassemble() const {
         return get_label("lambda{}", dest_offset);
     };
 
+    const auto format_datum = [this](const auto& self, const scheme_constant& datum) -> std::string {
+        const overload datum_formatter{
+            [](const empty_list&) {
+                return std::string{"()"};
+            },
+            [](const symbol& v) {
+                return std::string{v.name()};
+            },
+            [&self, this](const pair_constant& v) {
+                std::string str = "(" + self(self, constants[v.car_index]);
+
+                const scheme_constant* cdr_ptr = &constants[v.cdr_index];
+                while (const auto* const cdr_pair_ptr = std::get_if<pair_constant>(cdr_ptr)) {
+                    str += " " + self(self, constants[cdr_pair_ptr->car_index]);
+                    cdr_ptr = &constants[cdr_pair_ptr->cdr_index];
+                }
+
+                if (!std::holds_alternative<empty_list>(*cdr_ptr))
+                    str += " . " + self(self, *cdr_ptr);
+
+                return str + ")";
+            },
+            [](const auto& v) -> std::string {
+                if constexpr (std::is_arithmetic_v<std::remove_cvref_t<decltype(v)>>)
+                    return std::format("{}", v);
+                else
+                    throw std::runtime_error("pair constant contains a constant that isn't a datum");
+            },
+        };
+
+        return std::visit(datum_formatter, datum);
+    };
+
     const overload scheme_constant_formatter{
         [&bp_ptr_to_name](const builtin_procedure& v) {
             if (!bp_ptr_to_name.contains(v))
@@ -106,11 +470,14 @@ std::string bytecode::disassemble() const {
         [&get_lambda_label](const lambda_constant& v) {
             return get_lambda_label(v.bytecode_offset);
         },
+        [&format_datum](const pair_constant& v) {
+            return std::format("pair: {}", format_datum(format_datum, v));
+        },
         [](const empty_list&) {
             return std::format("()");
         },
         [](const symbol& v) {
-            return std::format("symbol: {}", v);
+            return std::format("symbol: {}", v.name());
         },
         [](const auto& v) {
             return std::format("{}", v);
@@ -118,8 +485,11 @@ std::string bytecode::disassemble() const {
     };
 
     const auto get_jump_dest_offset = [](const auto& code, const uint8_t* const instruction_ptr) {
-        const auto jump_size = read_value<jump_size_type>(instruction_ptr + 1) + 1;
-        const size_t dest_offset = (instruction_ptr + jump_size) - code.data();
+        const auto jump_size = read_value<jump_size_type>(instruction_ptr + 1);
+        const uint8_t* const dest_ptr = *instruction_ptr == static_cast<uint8_t>(opcode::jump_backward)
+            ? instruction_ptr + 1 - jump_size
+            : instruction_ptr + 1 + jump_size;
+        const size_t dest_offset = dest_ptr - code.data();
         return dest_offset;
     };
 
@@ -128,9 +498,10 @@ std::string bytecode::disassemble() const {
     };
 
     std::unordered_map<size_t, std::string> offset_to_label_map;
-    for (size_t offset = 0; offset < code.size(); offset += opcode_infos.at(code[offset]).size)
+    for (size_t offset = 0; offset < code.size(); offset += get_instruction_size(code.data() + offset))
         if (
-            code[offset] == static_cast<uint8_t>(opcode::jump_forward)
+            code[offset] == static_cast<uint8_t>(opcode::jump_backward)
+            or code[offset] == static_cast<uint8_t>(opcode::jump_forward)
             or code[offset] == static_cast<uint8_t>(opcode::jump_forward_if_not)
         ) {
             const size_t dest_offset = get_jump_dest_offset(code, code.data() + offset);
@@ -142,6 +513,30 @@ std::string bytecode::disassemble() const {
         else if (const auto* const hrp_ptr = std::get_if<hand_rolled_procedure_constant>(&c))
             offset_to_label_map[hrp_ptr->bytecode_offset] = std::format("hrp: {}:", hrp_ptr->name);
 
+    // NOTE: ArgSize is 1 for a regular make_closure and sizeof(wide_arg_type) for a wide one.
+    const auto make_closure_formatter = [this, &scheme_constant_formatter]<size_t ArgSize>(const uint8_t* const args) {
+        const auto get_arg = [args](const size_t i) -> uint32_t {
+            if constexpr (ArgSize == 1)
+                return args[i];
+            else
+                return read_value<wide_arg_type>(args + i * ArgSize);
+        };
+
+        constexpr std::array<const char*, 4> capture_kind_names{"self", "shared", "value", "box"};
+
+        std::string str = std::visit(scheme_constant_formatter, constants[get_arg(0)]);
+        for (uint32_t i = 0; i < get_arg(1); i++) {
+            const uint32_t descriptor = get_arg(2 + i);
+            str += std::format(
+                " {}:{}",
+                capture_kind_names.at(descriptor & ((1 << capture_kind_bits) - 1)),
+                descriptor >> capture_kind_bits
+            );
+        }
+
+        return str;
+    };
+
     const auto* const start_ptr = code.data();
     const auto disassembly_line_formatter = [&offset_to_label_map, start_ptr](
         const auto* const current_ptr,
@@ -178,19 +573,32 @@ std::string bytecode::disassemble() const {
             case static_cast<uint8_t>(opcode::call):
                 str += disassembly_line_formatter(instruction_ptr, "");
                 break;
-            case static_cast<uint8_t>(opcode::capture_shared_var):
-                str += disassembly_line_formatter(instruction_ptr, *(instruction_ptr + 1));
-                break;
-            case static_cast<uint8_t>(opcode::capture_stack_var):
-                str += disassembly_line_formatter(instruction_ptr, *(instruction_ptr + 1));
-                break;
+            case static_cast<uint8_t>(opcode::car):
+            case static_cast<uint8_t>(opcode::cdr):
             case static_cast<uint8_t>(opcode::cons):
+            case static_cast<uint8_t>(opcode::equal_numeric):
+            case static_cast<uint8_t>(opcode::greater):
+            case static_cast<uint8_t>(opcode::greater_equal):
+            case static_cast<uint8_t>(opcode::less):
+            case static_cast<uint8_t>(opcode::less_equal):
+            case static_cast<uint8_t>(opcode::minus):
+            case static_cast<uint8_t>(opcode::multiply):
+            case static_cast<uint8_t>(opcode::null):
+            case static_cast<uint8_t>(opcode::plus):
                 str += disassembly_line_formatter(instruction_ptr, "");
                 break;
             case static_cast<uint8_t>(opcode::expect_argc):
                 str += disassembly_line_formatter(instruction_ptr, *(instruction_ptr + 1));
                 break;
+            case static_cast<uint8_t>(opcode::make_closure):
+                str += disassembly_line_formatter(
+                    instruction_ptr,
+                    make_closure_formatter.template operator()<1>(instruction_ptr + 1)
+                );
+                break;
             case static_cast<uint8_t>(opcode::push_continuation):
+            case static_cast<uint8_t>(opcode::push_escape_continuation):
+            case static_cast<uint8_t>(opcode::push_prompt):
                 str += disassembly_line_formatter(instruction_ptr, "");
                 break;
             case static_cast<uint8_t>(opcode::push_constant):
@@ -214,16 +622,14 @@ std::string bytecode::disassemble() const {
                     get_jump_label(get_jump_dest_offset(code, instruction_ptr))
                 );
                 break;
+            case static_cast<uint8_t>(opcode::jump_backward):
             case static_cast<uint8_t>(opcode::jump_forward):
                 str += disassembly_line_formatter(
                     instruction_ptr,
                     get_jump_label(get_jump_dest_offset(code, instruction_ptr))
                 );
                 break;
-            case static_cast<uint8_t>(opcode::set_coarity_any):
-                str += disassembly_line_formatter(instruction_ptr, "");
-                break;
-            case static_cast<uint8_t>(opcode::set_coarity_one):
+            case static_cast<uint8_t>(opcode::pop):
                 str += disassembly_line_formatter(instruction_ptr, "");
                 break;
             case static_cast<uint8_t>(opcode::set_shared_var):
@@ -232,29 +638,129 @@ std::string bytecode::disassemble() const {
             case static_cast<uint8_t>(opcode::set_stack_var):
                 str += disassembly_line_formatter(instruction_ptr, *(instruction_ptr + 1));
                 break;
+            case static_cast<uint8_t>(opcode::shift):
+                str += disassembly_line_formatter(instruction_ptr, "");
+                break;
+            case static_cast<uint8_t>(opcode::tail_call):
+                str += disassembly_line_formatter(instruction_ptr, "");
+                break;
             case static_cast<uint8_t>(opcode::ret):
                 str += disassembly_line_formatter(instruction_ptr, "");
                 break;
             case static_cast<uint8_t>(opcode::halt):
                 str += disassembly_line_formatter(instruction_ptr, "");
                 break;
+            case static_cast<uint8_t>(opcode::wide): {
+                const uint8_t wide_opcode = *(instruction_ptr + 1);
+                const auto arg = read_value<wide_arg_type>(instruction_ptr + 2);
+
+                if (wide_opcode == static_cast<uint8_t>(opcode::make_closure)) {
+                    str += disassembly_line_formatter(
+                        instruction_ptr,
+                        std::format(
+                            "{} {}",
+                            opcode_infos.at(wide_opcode).name,
+                            make_closure_formatter.template operator()<sizeof(wide_arg_type)>(instruction_ptr + 2)
+                        )
+                    );
+                    break;
+                }
+
+                str += disassembly_line_formatter(
+                    instruction_ptr,
+                    std::format(
+                        "{} {}",
+                        opcode_infos.at(wide_opcode).name,
+                        wide_opcode == static_cast<uint8_t>(opcode::push_constant)
+                            ? std::visit(scheme_constant_formatter, constants[arg])
+                            : std::to_string(arg)
+                    )
+                );
+                break;
+            }
             default:
                 throw std::runtime_error("invalid opcode");
         }
 
-        instruction_ptr += opcode_infos.at(*instruction_ptr).size;
+        instruction_ptr += get_instruction_size(instruction_ptr);
     }
 
     return str;
 }
 
-const scheme_constant& bytecode::get_constant(uint8_t index) const {
+size_t bytecode::get_block_size() const {
+    return compiling_blocks.back().code.size();
+}
+
+const scheme_constant& bytecode::get_constant(uint32_t index) const {
     if (index >= constants.size())
         throw std::runtime_error("constant index out of bounds");
 
     return constants[index];
 }
 
+uint32_t bytecode::get_constant_count() const {
+    return static_cast<uint32_t>(constants.size());
+}
+
+size_t bytecode::get_instruction_size(const uint8_t* const instruction) {
+    if (*instruction == static_cast<uint8_t>(opcode::make_closure))
+        return sizeof(opcode_make_closure) + instruction[2];
+
+    if (*instruction == static_cast<uint8_t>(opcode::wide) and instruction[1] == static_cast<uint8_t>(opcode::make_closure)) {
+        // the prefix and opcode, then the lambda constant index, capture count and descriptors
+        const auto capture_count = read_value<wide_arg_type>(instruction + 2 + sizeof(wide_arg_type));
+        return 2 + (2 + capture_count) * sizeof(wide_arg_type);
+    }
+
+    return opcode_infos.at(*instruction).size;
+}
+
+uint64_t bytecode::get_fingerprint() {
+    static const uint64_t fingerprint = [] {
+        std::vector<uint8_t> bytes;
+        append_value(bytes, bytecode_file_version);
+
+        for (const auto& info : opcode_infos) {
+            append_name(bytes, info.name);
+            append_value(bytes, info.size);
+        }
+
+        // NOTE: hand-rolled procedure code is copied into every program, so programs compiled with
+        // different versions of it aren't compatible.
+        std::vector<std::string_view> hrp_names;
+        for (const auto& [name, code] : hrp_name_to_code)
+            hrp_names.emplace_back(name);
+        std::ranges::sort(hrp_names);
+
+        for (const auto name : hrp_names) {
+            const auto& code = hrp_name_to_code.at(name);
+            append_name(bytes, name);
+            append_value(bytes, static_cast<uint64_t>(code.size()));
+            bytes.insert(bytes.end(), code.begin(), code.end());
+        }
+
+        return hash(bytes);
+    }();
+
+    return fingerprint;
+}
+
+uint64_t bytecode::hash(const std::span<const uint8_t> bytes) {
+    uint64_t h = 0xcbf29ce484222325;
+    for (const auto byte : bytes) {
+        h ^= byte;
+        h *= 0x100000001b3;
+    }
+
+    return h;
+}
+
+bool bytecode::is_serialized(const std::span<const uint8_t> bytes) {
+    return bytes.size() >= bytecode_file_magic.size()
+        and std::ranges::equal(bytes.first(bytecode_file_magic.size()), bytecode_file_magic);
+}
+
 size_t bytecode::prepare_backpatch_jump(const opcode jump_type) {
     append_opcode(jump_type);
 
@@ -271,19 +777,86 @@ void bytecode::pop_lambda() {
     compiling_blocks.pop_back();
 }
 
-uint8_t bytecode::push_hand_rolled_procedure(const std::string_view& name) {
-    const hand_rolled_procedure_constant hrpc{name};
+uint32_t bytecode::push_hand_rolled_procedure(const std::string_view& name) {
+    const auto hrp_it = hrp_name_to_code.find(name);
+    if (hrp_it == hrp_name_to_code.end())
+        throw std::runtime_error("unknown hand-rolled procedure");
+
+    // NOTE: the constant takes its name from the map rather than the given name, which may be a
+    // view of the source, since the constant outlives the source.
+    const hand_rolled_procedure_constant hrpc{hrp_it->first, 0};
 
     if (constant_to_index_map.contains(hrpc)) {
         return constant_to_index_map[hrpc];
     }
 
-    uint8_t constant_index = add_constant(hrpc);
-    compiled_blocks.emplace_back(hrp_name_to_code.at(name), constant_index);
+    uint32_t constant_index = add_constant(hrpc);
+    compiled_blocks.emplace_back(hrp_it->second, constant_index);
 
     return constant_index;
 }
 
-void bytecode::push_lambda(uint8_t lambda_constant_index) {
+void bytecode::push_lambda(uint32_t lambda_constant_index) {
     compiling_blocks.emplace_back(lambda_code{{}, lambda_constant_index});
 }
+
+std::vector<uint8_t> bytecode::serialize() const {
+    std::vector<uint8_t> bytes;
+
+    append_value(
+        bytes,
+        bytecode_file_header{bytecode_file_magic, get_fingerprint(), constants.size(), code.size()}
+    );
+
+    const auto& bp_ptr_to_name = get_bp_ptr_to_name();
+
+    const overload constant_serializer{
+        [&bytes](const bool& v) {
+            append_value(bytes, serialized_constant_kind::boolean);
+            append_value<uint8_t>(bytes, v);
+        },
+        [&bytes, &bp_ptr_to_name](const builtin_procedure& v) {
+            if (!bp_ptr_to_name.contains(v))
+                throw std::runtime_error("builtin procedure not found by address");
+
+            append_value(bytes, serialized_constant_kind::builtin_procedure);
+            append_name(bytes, bp_ptr_to_name.at(v));
+        },
+        [&bytes](const empty_list&) {
+            append_value(bytes, serialized_constant_kind::empty_list);
+        },
+        [&bytes](const int64_t& v) {
+            append_value(bytes, serialized_constant_kind::fixnum);
+            append_value(bytes, v);
+        },
+        [&bytes](const double& v) {
+            append_value(bytes, serialized_constant_kind::flonum);
+            append_value(bytes, v);
+        },
+        [&bytes](const hand_rolled_procedure_constant& v) {
+            append_value(bytes, serialized_constant_kind::hand_rolled_procedure);
+            append_name(bytes, v.name);
+            append_value<uint64_t>(bytes, v.bytecode_offset);
+        },
+        [&bytes](const lambda_constant& v) {
+            append_value(bytes, serialized_constant_kind::lambda);
+            append_value<uint64_t>(bytes, v.bytecode_offset);
+        },
+        [&bytes](const pair_constant& v) {
+            append_value(bytes, serialized_constant_kind::pair);
+            append_value(bytes, v.car_index);
+            append_value(bytes, v.cdr_index);
+        },
+        [&bytes](const symbol& v) {
+            append_value(bytes, serialized_constant_kind::symbol);
+            append_name(bytes, v.name());
+        },
+    };
+
+    for (const auto& c : constants)
+        std::visit(constant_serializer, c);
+
+    bytes.insert(bytes.end(), code.begin(), code.end());
+
+    return bytes;
+}
@@ -1,25 +1,278 @@
 #include <charconv>
 #include <format>
 #include <limits>
+#include <optional>
 #include <stdexcept>
 #include <system_error>
+#include <utility>
+#include <vector>
 
 #include "bytecode.hpp"
 #include "compiler.hpp"
 #include "virtual_machine.hpp"
 
-compiler::compiler(const std::vector<token>& tokens)
-    : current_token_ptr{tokens.data()} {
+/**
+ * Returns a cursor at the token just past the expression starting at the given token. Stops at eof
+ * if the expression is incomplete.
+ */
+static token_cursor skip_expression(token_cursor t) {
+    // a quote and its datum are skipped together
+    while (t.type() == token_type::single_quote)
+        t++;
+
+    if (t.type() == token_type::eof)
+        return t;
+
+    if (t.type() != token_type::left_paren)
+        return t + 1;
+
+    size_t depth = 0;
+    do {
+        if (t.type() == token_type::eof)
+            return t;
+
+        if (t.type() == token_type::left_paren)
+            depth++;
+        else if (t.type() == token_type::right_paren)
+            depth--;
+
+        t++;
+    } while (depth != 0);
+
+    return t;
+}
+
+/**
+ * Checks if the given identifier appears anywhere in the expression starting at the given token.
+ */
+static bool mentions_identifier(token_cursor t, const std::string_view name) {
+    for (const token_cursor end = skip_expression(t); t < end; t++)
+        if (t.type() == token_type::identifier and t.value() == name)
+            return true;
+
+    return false;
+}
+
+/**
+ * Checks if the expression starting at the given token has no side effects, meaning it can be left
+ * out entirely when its result is discarded.
+ */
+static bool is_pure_expression(const token_cursor t) {
+    switch (t.type()) {
+        case token_type::number:
+        case token_type::identifier:
+        case token_type::boolean_true:
+        case token_type::boolean_false:
+        case token_type::single_quote:
+            return true;
+        case token_type::left_paren:
+            return (t + 1).value() == "lambda" or (t + 1).value() == "quote";
+        default:
+            return false;
+    }
+}
+
+/**
+ * Checks if the dedicated builtin opcode for the call whose args start at the given token can't
+ * fail, meaning that it can be left out if the call's result is discarded. To keep this simple, that
+ * only holds for opcodes that take any args (cons and null?) and for args that are literals of the
+ * right type: numbers for arithmetic and comparisons, and quoted non-empty lists for car and cdr.
+ */
+static bool is_infallible_builtin_opcode(const opcode op, token_cursor arg) {
+    switch (op) {
+        case opcode::cons:
+        case opcode::null:
+            return true;
+        case opcode::car:
+        case opcode::cdr:
+            return arg.type() == token_type::single_quote
+                and (arg + 1).type() == token_type::left_paren
+                and (arg + 2).type() != token_type::right_paren;
+        default:
+            while (arg.type() == token_type::number)
+                arg++;
+
+            return arg.type() == token_type::right_paren;
+    }
+}
+
+/**
+ * Checks if the procedure call whose procedure expression starts at the given token is a call/cc
+ * call that can be compiled as call/ec without changing what the program does. That takes more than
+ * the continuation not escaping the call: if a continuation that includes the call could be
+ * captured while it runs (e.g. by a call/cc in a procedure it calls), the call could be resumed
+ * after it has returned, which only a full continuation supports. To keep this simple and
+ * conservative, the only arg must be a lambda whose one parameter (the continuation) is only ever
+ * the procedure expression of a procedure call and isn't mentioned by any nested lambda, and every
+ * procedure call in its body must call either the continuation or a builtin procedure, since
+ * builtins never call back into scheme code.
+ */
+static bool is_escape_only_call_cc(const token_cursor t) {
+    if (t.type() != token_type::identifier or t.value() != "call/cc")
+        return false;
+
+    const token_cursor arg = t + 1;
+    if (
+        arg.type() != token_type::left_paren
+        or (arg + 1).value() != "lambda"
+        or (arg + 2).type() != token_type::left_paren
+        or (arg + 3).type() != token_type::identifier
+        or (arg + 4).type() != token_type::right_paren
+    )
+        return false;
+
+    const token_cursor arg_end = skip_expression(arg);
+    if (arg_end.type() != token_type::right_paren)
+        return false;
+
+    const std::string_view continuation_name = (arg + 3).value();
+    const auto is_continuation = [&continuation_name](const token_cursor n) {
+        return n.type() == token_type::identifier and n.value() == continuation_name;
+    };
+
+    for (token_cursor b = arg + 5; b < arg_end; b++) {
+        if (b.type() == token_type::single_quote or (b.type() == token_type::left_paren and (b + 1).value() == "quote")) {
+            // quoted data is never evaluated
+            b = skip_expression(b.type() == token_type::single_quote ? b + 1 : b) - 1;
+        } else if (b.type() == token_type::left_paren and (b + 1).value() == "lambda") {
+            // nested lambdas can outlive the call, so they can't refer to the continuation at all.
+            // Their bodies only run if they're called, which the checks below rule out.
+            const token_cursor nested_end = skip_expression(b);
+            for (token_cursor n = b; n < nested_end; n++)
+                if (is_continuation(n))
+                    return false;
+
+            b = nested_end - 1;
+        } else if (b.type() == token_type::left_paren) {
+            // every other list is either a special form that doesn't call anything itself or a
+            // procedure call, whose procedure has to be the continuation or a builtin. This also
+            // rules out let and do forms with bindings, whose binding lists look like calls.
+            const token_cursor head = b + 1;
+            const bool is_plain_special_form = head.value() == "if"
+                or head.value() == "set!"
+                or head.value() == "define"
+                or head.value() == "let"
+                or head.value() == "do";
+
+            if (
+                head.type() != token_type::right_paren
+                and !is_continuation(head)
+                and !(head.type() == token_type::identifier and (is_plain_special_form or bp_name_to_ptr.contains(head.value())))
+            )
+                return false;
+        } else if (is_continuation(b) and (b - 1).type() != token_type::left_paren) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+compiler::compiler(tokenizer& t) {
     push_lambda();
 
-    compile_expression_sequence<coarity_type::any, &compiler::eof>();
+    // NOTE: top-level expressions are compiled one at a time as they're read so that the tokens of
+    // the whole program never have to exist at once. Their results are all discarded, so, unlike
+    // other expression sequences, there's no need to know which expression is the final one.
+    push_coarity(coarity_type::any);
+
+    while (t.read_expression()) {
+        assigned_vars.clear();
+        folded_calls.clear();
+        for (token_cursor c = t.tokens.begin(); c.type() != token_type::eof; c++)
+            if (c.type() == token_type::left_paren and (c + 1).value() == "set!" and (c + 2).type() == token_type::identifier)
+                assigned_vars.emplace((c + 2).value());
+
+        current_token = t.tokens.begin();
+        compile_expression();
+
+        if (!eof())
+            throw std::runtime_error("unexpected token after top-level expression");
+    }
 
+    pop_coarity();
+
+    // like any other lambda, the top level returns exactly one value
+    push_unspecified();
     program.append_opcode(opcode::ret);
     pop_lambda();
     program.concat_blocks();
 }
 
-uint8_t compiler::add_shared_var(const std::string_view& var_name, size_t scope_depth) {
+uint32_t compiler::add_datum_constant() {
+    uint32_t constant_index;
+
+    switch (current_token.type()) {
+        case token_type::number:
+            constant_index = program.add_constant(generate_number_constant());
+            current_token++;
+            break;
+        case token_type::boolean_true:
+        case token_type::boolean_false:
+            constant_index = program.add_constant(generate_boolean_constant());
+            current_token++;
+            break;
+        case token_type::identifier:
+            constant_index = program.add_constant(symbol::intern(current_token.value()));
+            current_token++;
+            break;
+        case token_type::single_quote: {
+            // NOTE: the tokenizer doesn't expand single quotes, so 'x is built as (quote x) here.
+            const uint32_t quote_index = program.add_constant(symbol::intern(quote_symbol));
+
+            current_token++;
+            const uint32_t datum_index = add_datum_constant();
+
+            const uint32_t datum_list_index = program.add_constant(pair_constant{datum_index, program.add_constant(empty_list{})});
+            constant_index = program.add_constant(pair_constant{quote_index, datum_list_index});
+            break;
+        }
+        case token_type::left_paren:
+            current_token++;
+            constant_index = add_list_constant();
+            break;
+        default:
+            throw std::runtime_error(std::format("unexpected token for external representation: {}", static_cast<uint8_t>(current_token.type())));
+    }
+
+    return constant_index;
+}
+
+uint32_t compiler::add_list_constant() {
+    // the elements are collected first so that only nested lists recurse, not long ones
+    std::vector<uint32_t> element_indexes;
+    uint32_t tail_index;
+
+    while (true) {
+        if (eof())
+            throw std::runtime_error("unexpected eof in pair");
+
+        if (current_token.type() == token_type::right_paren) {
+            tail_index = program.add_constant(empty_list{});
+            current_token++;
+            break;
+        }
+
+        if (current_token.type() == token_type::dot) {
+            if (element_indexes.empty())
+                throw std::runtime_error("unexpected dot in pair");
+
+            current_token++;
+            tail_index = add_datum_constant();
+            consume_token(token_type::right_paren);
+            break;
+        }
+
+        element_indexes.push_back(add_datum_constant());
+    }
+
+    for (auto it = element_indexes.rbegin(); it != element_indexes.rend(); it++)
+        tail_index = program.add_constant(pair_constant{*it, tail_index});
+
+    return tail_index;
+}
+
+uint32_t compiler::add_shared_var(const std::string_view& var_name, size_t scope_depth) {
     if (scope_depth >= lambda_stack.size())
         throw std::runtime_error("adding shared var to non-existent scope");
 
@@ -28,9 +281,9 @@ uint8_t compiler::add_shared_var(const std::string_view& var_name, size_t scope_
     if (ctx.shared_vars.contains(var_name))
         throw std::runtime_error("shared var already exists");
 
-    uint8_t var_id = static_cast<uint8_t>(ctx.shared_vars.size());
+    uint32_t var_id = static_cast<uint32_t>(ctx.shared_vars.size());
 
-    if (var_id == std::numeric_limits<uint8_t>::max())
+    if (var_id == std::numeric_limits<uint32_t>::max())
         throw std::runtime_error("shared var limit exceeded");
 
     ctx.shared_vars[var_name] = var_id;
@@ -46,56 +299,255 @@ void compiler::add_stack_var(const std::string_view& var_name) {
     if (ctx.stack_vars.contains(var_name))
         throw std::runtime_error("stack var already exists");
 
-    uint8_t var_id = static_cast<uint8_t>(ctx.stack_vars.size());
+    uint32_t var_id = static_cast<uint32_t>(ctx.stack_vars.size());
 
-    if (var_id == std::numeric_limits<uint8_t>::max())
+    if (var_id == std::numeric_limits<uint32_t>::max())
         throw std::runtime_error("stack var limit exceeded");
 
     ctx.stack_vars[var_name] = var_id;
+
+    // NOTE: top-level variables can be assigned by later top-level expressions, which haven't been
+    // read yet.
+    if (lambda_stack.size() == 1 or assigned_vars.contains(var_name))
+        ctx.boxed_stack_vars.emplace(var_name);
+}
+
+void compiler::compile_argc_check(const uint32_t argc) {
+    program.append_opcode(opcode::expect_argc, argc);
+
+    auto& ctx = get_current_lambda();
+    ctx.argc = argc;
+    ctx.loop_index = program.get_block_size();
 }
 
 void compiler::compile_boolean() {
-    uint8_t constant_index = program.add_constant(generate_boolean_constant());
+    uint32_t constant_index = program.add_constant(generate_boolean_constant());
 
-    program.append_opcode(opcode::push_constant);
-    program.append_byte(constant_index);
+    program.append_opcode(opcode::push_constant, constant_index);
 
-    current_token_ptr++;
+    current_token++;
 }
 
 void compiler::compile_define() {
-    current_token_ptr++;
+    current_token++;
 
     if (eof())
         throw std::runtime_error("unexpected eof after define");
 
-    if (current_token_ptr->type != token_type::identifier)
+    if (current_token.type() != token_type::identifier)
         throw std::runtime_error("expected identifier in define");
 
-    add_stack_var(current_token_ptr->value);
+    const std::string_view var_name = current_token.value();
+    add_stack_var(var_name);
+
+    current_token++;
+
+    // A lambda created by the init expression that refers to the variable captures it before it
+    // has its value, so it can't be captured by value. The exception is when the init expression is
+    // that lambda, since then the variable's stack slot is the lambda itself when it's captured.
+    const bool is_lambda_init = current_token.type() == token_type::left_paren and (current_token + 1).value() == "lambda";
+    if (!is_lambda_init and mentions_identifier(current_token, var_name))
+        get_current_lambda().boxed_stack_vars.emplace(var_name);
 
     push_coarity(coarity_type::one);
 
-    current_token_ptr++;
     compile_expression();
 
     program.append_opcode(opcode::add_stack_var);
 
     pop_coarity();
 
+    if (!is_discarding())
+        push_unspecified();
+
     consume_token(token_type::right_paren);
 }
 
-void compiler::compile_procedure_call() {
+void compiler::compile_do(const bool is_tail) {
+    current_token++;
+    consume_token(token_type::left_paren);
+
+    const token_cursor bindings = current_token;
+
+    program.append_opcode(opcode::push_frame_index);
+
+    push_lambda();
+
+    // add loop vars to the lambda, and find the steps, which are compiled after the body
+    std::vector<std::optional<token_cursor>> steps;
+    while (!eof() and current_token.type() != token_type::right_paren) {
+        consume_token(token_type::left_paren);
+
+        if (current_token.type() != token_type::identifier)
+            throw std::runtime_error("non-identifier in do binding");
+
+        if (steps.size() == std::numeric_limits<uint32_t>::max())
+            throw std::runtime_error("exceeded do binding limit");
+
+        if ((current_token + 1).type() == token_type::right_paren)
+            throw std::runtime_error("missing init in do binding");
+
+        add_stack_var(current_token.value());
+
+        current_token = skip_expression(current_token + 1);
+        if (current_token.type() == token_type::right_paren) {
+            steps.emplace_back(std::nullopt);
+        } else {
+            steps.emplace_back(current_token);
+            current_token = skip_expression(current_token);
+        }
+
+        consume_token(token_type::right_paren);
+    }
+    consume_token(token_type::right_paren);
+
+    compile_argc_check(static_cast<uint32_t>(steps.size()));
+
+    // compile test, and the results for when it's true
+    consume_token(token_type::left_paren);
+
+    push_coarity(coarity_type::one);
+    compile_expression();
+    pop_coarity();
+
+    const size_t backpatch_index = program.prepare_backpatch_jump(opcode::jump_forward_if_not);
+
+    if (current_token.type() == token_type::right_paren)
+        push_unspecified();
+    else
+        compile_expression_sequence<coarity_type::one, &compiler::eof, &compiler::at_sentinel<token_type::right_paren>>();
+
+    consume_token(token_type::right_paren);
+    program.append_opcode(opcode::ret);
+
+    program.backpatch_jump(backpatch_index);
+
+    // compile commands, then the steps as the args of the next iteration
+    if (current_token.type() != token_type::right_paren)
+        compile_expression_sequence<coarity_type::any, &compiler::eof, &compiler::at_sentinel<token_type::right_paren>>();
+
+    const token_cursor end = current_token;
+
+    push_coarity(coarity_type::one);
+    for (uint32_t var_id = 0; var_id < steps.size(); var_id++) {
+        // a var without a step keeps its value
+        if (steps[var_id]) {
+            current_token = *steps[var_id];
+            compile_expression();
+        } else {
+            program.append_opcode(opcode::push_stack_var, var_id);
+        }
+    }
+    pop_coarity();
+
+    program.append_jump_backward(get_current_lambda().loop_index);
+
+    current_token = end;
+    consume_token(token_type::right_paren);
+
+    pop_lambda();
+
+    compile_let_call(bindings, is_tail);
+}
+
+void compiler::compile_builtin_opcode(const opcode op) {
+    current_token++;
+
+    // If the result is going to be discarded and the opcode can't fail, then the args only need to
+    // be evaluated for their side effects. Otherwise the opcode still runs so that it raises the
+    // same errors that it would if the result were used.
+    const bool is_skipped = is_discarding() and is_infallible_builtin_opcode(op, current_token);
+    if (!is_skipped)
+        push_coarity(coarity_type::one);
+
+    while (!eof() and current_token.type() != token_type::right_paren)
+        compile_expression();
+
+    if (eof())
+        throw std::runtime_error("unexpected eof in procedure call expression");
+
+    current_token++;
+
+    if (is_skipped)
+        return;
+
+    pop_coarity();
+    program.append_opcode(op);
+
+    if (is_discarding())
+        program.append_opcode(opcode::pop);
+}
+
+void compiler::compile_procedure_call(const bool is_tail) {
+    if (current_token.type() == token_type::identifier and pure_bp_names.contains(current_token.value())) {
+        const token_cursor procedure_token = current_token;
+
+        // fold from the call's left paren
+        current_token = current_token - 1;
+        if (const auto folded = generate_folded_constant()) {
+            // a folded call has no side effects, so there's nothing left to do if it's discarded
+            if (!is_discarding())
+                program.append_opcode(opcode::push_constant, program.add_constant(*folded));
+
+            return;
+        }
+
+        current_token = procedure_token;
+    }
+
+    if (current_token.type() == token_type::identifier) {
+        const auto it = bp_name_to_opcode.find(current_token.value());
+
+        if (it != bp_name_to_opcode.end() and it->second.argc == count_procedure_args()) {
+            compile_builtin_opcode(it->second.op);
+            return;
+        }
+    }
+
+    // a named let's lambda calling itself in tail position loops instead
+    if (is_tail and current_token.type() == token_type::identifier) {
+        const std::string_view name = current_token.value();
+        const auto& ctx = get_current_lambda();
+
+        if (
+            name == ctx.self_name
+            and !ctx.stack_vars.contains(name)
+            and !bp_name_to_ptr.contains(name)
+            and !hrp_name_to_code.contains(name)
+            and count_procedure_args() == ctx.argc
+        ) {
+            // NOTE: the lambda stack can grow while compiling the args, so ctx can't be used after
+            // this.
+            const size_t loop_index = ctx.loop_index;
+
+            current_token++;
+
+            push_coarity(coarity_type::one);
+            while (!eof() and current_token.type() != token_type::right_paren)
+                compile_expression();
+            pop_coarity();
+
+            consume_token(token_type::right_paren);
+
+            program.append_jump_backward(loop_index);
+            return;
+        }
+    }
+
     push_coarity(coarity_type::one);
 
     program.append_opcode(opcode::push_frame_index);
 
     // compile procedure expression
-    compile_expression();
+    if (is_escape_only_call_cc(current_token)) {
+        program.append_opcode(opcode::push_constant, program.push_hand_rolled_procedure("call/ec"));
+        current_token++;
+    } else {
+        compile_expression();
+    }
 
     // compile procedure args
-    while (!eof() and current_token_ptr->type != token_type::right_paren)
+    while (!eof() and current_token.type() != token_type::right_paren)
         compile_expression();
 
     if (eof())
@@ -103,13 +555,30 @@ void compiler::compile_procedure_call() {
 
     pop_coarity();
 
-    current_token_ptr++;
+    current_token++;
+
+    program.append_opcode(is_tail ? opcode::tail_call : opcode::call);
 
-    program.append_opcode(opcode::call);
+    if (is_discarding())
+        program.append_opcode(opcode::pop);
 }
 
 void compiler::compile_expression() {
-    switch (current_token_ptr->type) {
+    // tail position only applies to this expression, not its subexpressions
+    const bool is_tail = std::exchange(tail_position, false);
+
+    if (is_discarding() and is_pure_expression(current_token)) {
+        // a discarded variable still has to exist, so look it up without pushing it
+        if (current_token.type() == token_type::identifier
+            and !bp_name_to_ptr.contains(current_token.value())
+            and !hrp_name_to_code.contains(current_token.value()))
+            get_var_type_and_id(current_token.value());
+
+        current_token = skip_expression(current_token);
+        return;
+    }
+
+    switch (current_token.type()) {
         case token_type::number:
             compile_number();
             break;
@@ -121,105 +590,71 @@ void compiler::compile_expression() {
             compile_boolean();
             break;
         case token_type::single_quote:
-            current_token_ptr++;
+            current_token++;
             compile_external_representation_abbr();
             break;
         case token_type::left_paren:
-            current_token_ptr++;
+            current_token++;
 
             // TODO: maybe use a map for special forms if there's enough of them.
-            if (current_token_ptr->value == "if")
-                compile_if();
-            else if (current_token_ptr->value == "lambda")
+            if (current_token.value() == "if")
+                compile_if(is_tail);
+            else if (current_token.value() == "lambda")
                 compile_lambda();
-            else if (current_token_ptr->value == "set!")
+            else if (current_token.value() == "set!")
                 compile_set();
-            else if (current_token_ptr->value == "define")
+            else if (current_token.value() == "define")
                 compile_define();
-            else if (current_token_ptr->value == "quote")
+            else if (current_token.value() == "let")
+                compile_let(is_tail);
+            else if (current_token.value() == "do")
+                compile_do(is_tail);
+            else if (current_token.value() == "quote")
                 compile_external_representation();
+            else if (current_token.value() == "reset" or current_token.value() == "shift")
+                compile_reset_or_shift(is_tail);
             else
-                compile_procedure_call();
+                compile_procedure_call(is_tail);
 
             break;
         default:
-            throw std::runtime_error(std::format("unexpected token: {}", static_cast<uint8_t>(current_token_ptr->type)));
+            throw std::runtime_error(std::format("unexpected token: {}", static_cast<uint8_t>(current_token.type())));
     }
 }
 
 void compiler::compile_external_representation() {
-    current_token_ptr++;
+    current_token++;
     compile_external_representation_abbr();
     consume_token(token_type::right_paren);
 }
 
 void compiler::compile_external_representation_abbr() {
-    switch (current_token_ptr->type) {
-        case token_type::number:
-            compile_number();
-            break;
-        case token_type::boolean_true:
-        case token_type::boolean_false:
-            compile_boolean();
-            break;
-        case token_type::identifier:
-            program.append_opcode(opcode::push_constant);
-            program.append_byte(program.add_constant(symbol{current_token_ptr->value}));
-            current_token_ptr++;
-            break;
-        case token_type::single_quote:
-            // NOTE: currently we don't expand single quotes to (quote x) in tokenizer, and as a
-            // result we have to essentially compile a custom pair here with a static quote symbol.
-            // This solution is questionable at best since we now have two locations in the code
-            // that compile pairs.
-            program.append_opcode(opcode::push_constant);
-            program.append_byte(program.add_constant(symbol{quote_symbol}));
-
-            current_token_ptr++;
-            compile_external_representation_abbr();
-
-            program.append_opcode(opcode::push_constant);
-            program.append_byte(program.add_constant(empty_list{}));
-
-            program.append_opcode(opcode::cons);
-            program.append_opcode(opcode::cons);
-            break;
-        case token_type::left_paren:
-            current_token_ptr++;
-            compile_pair();
-            break;
-        default:
-            throw std::runtime_error(std::format("unexpected token for external representation: {}", static_cast<uint8_t>(current_token_ptr->type)));
-    }
+    program.append_opcode(opcode::push_constant, add_datum_constant());
 }
 
 void compiler::compile_identifier() {
-    if (bp_name_to_ptr.contains(current_token_ptr->value)) {
-        uint8_t constant_index = program.add_constant(bp_name_to_ptr.at(current_token_ptr->value));
+    if (bp_name_to_ptr.contains(current_token.value())) {
+        uint32_t constant_index = program.add_constant(bp_name_to_ptr.at(current_token.value()));
 
-        program.append_opcode(opcode::push_constant);
-        program.append_byte(constant_index);
-    } else if (hrp_name_to_code.contains(current_token_ptr->value)) {
-        uint8_t constant_index = program.push_hand_rolled_procedure(current_token_ptr->value);
+        program.append_opcode(opcode::push_constant, constant_index);
+    } else if (hrp_name_to_code.contains(current_token.value())) {
+        uint32_t constant_index = program.push_hand_rolled_procedure(current_token.value());
 
-        program.append_opcode(opcode::push_constant);
-        program.append_byte(constant_index);
+        program.append_opcode(opcode::push_constant, constant_index);
     } else {
-        const auto [var_type, var_id] = get_var_type_and_id(current_token_ptr->value);
+        const auto [var_type, var_id] = get_var_type_and_id(current_token.value());
 
         if (var_type == variable_type::stack)
-            program.append_opcode(opcode::push_stack_var);
+            program.append_opcode(opcode::push_stack_var, var_id);
         else
-            program.append_opcode(opcode::push_shared_var);
-
-        program.append_byte(var_id);
+            program.append_opcode(opcode::push_shared_var, var_id);
     }
 
-    current_token_ptr++;
+    current_token++;
 }
 
-void compiler::compile_if() {
-    current_token_ptr++;
+void compiler::compile_if(const bool is_tail) {
+    current_token++;
 
     push_coarity(coarity_type::one);
 
@@ -232,14 +667,24 @@ void compiler::compile_if() {
     const size_t first_backpatch_index = program.prepare_backpatch_jump(opcode::jump_forward_if_not);
 
     // compile consequent
+    tail_position = is_tail;
     compile_expression();
 
     if (eof())
         throw std::runtime_error("unexpected eof after if consequent");
 
-    // if there's no alternate, backpatch the first jump, advance token, and we're done.
-    if (current_token_ptr->type == token_type::right_paren) {
-        program.backpatch_jump(first_backpatch_index);
+    // if there's no alternate, backpatch the first jump, advance token, and we're done. If the
+    // result is needed, the missing alternate evaluates to an unspecified value.
+    if (current_token.type() == token_type::right_paren) {
+        if (is_discarding()) {
+            program.backpatch_jump(first_backpatch_index);
+        } else {
+            const size_t second_backpatch_index = program.prepare_backpatch_jump(opcode::jump_forward);
+            program.backpatch_jump(first_backpatch_index);
+            push_unspecified();
+            program.backpatch_jump(second_backpatch_index);
+        }
+
         consume_token(token_type::right_paren);
         return;
     }
@@ -250,6 +695,7 @@ void compiler::compile_if() {
     program.backpatch_jump(first_backpatch_index);
 
     // compile alternate
+    tail_position = is_tail;
     compile_expression();
 
     program.backpatch_jump(second_backpatch_index);
@@ -261,25 +707,27 @@ void compiler::compile_lambda() {
     push_lambda();
 
     // add lambda args to current lambda_context
-    current_token_ptr++;
+    current_token++;
     consume_token(token_type::left_paren);
-    uint8_t argc = 0;
-    while (!eof() and current_token_ptr->type != token_type::right_paren) {
-        if (current_token_ptr->type != token_type::identifier)
+    uint32_t argc = 0;
+    while (!eof() and current_token.type() != token_type::right_paren) {
+        if (current_token.type() != token_type::identifier)
             throw std::runtime_error("non-identifier in lambda arg list");
 
-        if (argc == std::numeric_limits<uint8_t>::max())
+        if (argc == std::numeric_limits<uint32_t>::max())
             throw std::runtime_error("exceeded lambda arg limit");
 
-        add_stack_var(current_token_ptr->value);
+        add_stack_var(current_token.value());
         argc++;
-        current_token_ptr++;
+        current_token++;
     }
     consume_token(token_type::right_paren);
 
-    // compile expect_argc opcode which checks argc on stack
-    program.append_opcode(opcode::expect_argc);
-    program.append_byte(argc);
+    compile_lambda_body(argc);
+}
+
+void compiler::compile_lambda_body(const uint32_t argc) {
+    compile_argc_check(argc);
 
     // compile lambda body
     compile_expression_sequence<coarity_type::one, &compiler::eof, &compiler::at_sentinel<token_type::right_paren>>();
@@ -290,72 +738,164 @@ void compiler::compile_lambda() {
     pop_lambda();
 }
 
-void compiler::compile_number() {
-    uint8_t constant_index = program.add_constant(generate_number_constant());
+void compiler::compile_let(const bool is_tail) {
+    current_token++;
 
-    program.append_opcode(opcode::push_constant);
-    program.append_byte(constant_index);
+    std::string_view name;
+    if (current_token.type() == token_type::identifier) {
+        name = current_token.value();
+        current_token++;
+    }
 
-    current_token_ptr++;
+    consume_token(token_type::left_paren);
+
+    const token_cursor bindings = current_token;
+
+    program.append_opcode(opcode::push_frame_index);
+
+    push_lambda();
+    get_current_lambda().self_name = name;
+
+    // add let vars to the lambda as its args, skipping over their inits
+    uint32_t argc = 0;
+    while (!eof() and current_token.type() != token_type::right_paren) {
+        consume_token(token_type::left_paren);
+
+        if (current_token.type() != token_type::identifier)
+            throw std::runtime_error("non-identifier in let binding");
+
+        if (argc == std::numeric_limits<uint32_t>::max())
+            throw std::runtime_error("exceeded let binding limit");
+
+        if ((current_token + 1).type() == token_type::right_paren)
+            throw std::runtime_error("missing init in let binding");
+
+        add_stack_var(current_token.value());
+        argc++;
+
+        current_token = skip_expression(current_token + 1);
+        consume_token(token_type::right_paren);
+    }
+    consume_token(token_type::right_paren);
+
+    compile_lambda_body(argc);
+
+    compile_let_call(bindings, is_tail);
 }
 
-void compiler::compile_pair() {
-    compile_external_representation_abbr();
+void compiler::compile_let_call(const token_cursor bindings, const bool is_tail) {
+    const token_cursor end = current_token;
+    current_token = bindings;
 
-    if (eof())
-        throw std::runtime_error("unexpected eof in pair");
+    push_coarity(coarity_type::one);
+
+    // the init is the second element of each binding, and any step after it is skipped
+    while (current_token.type() != token_type::right_paren) {
+        current_token = current_token + 2;
+        compile_expression();
+
+        if (current_token.type() != token_type::right_paren)
+            current_token = skip_expression(current_token);
 
-    if (current_token_ptr->type == token_type::dot) {
-        current_token_ptr++;
-        compile_external_representation_abbr();
         consume_token(token_type::right_paren);
-    } else if (current_token_ptr->type == token_type::right_paren) {
-        uint8_t constant_index = program.add_constant(empty_list{});
+    }
+
+    pop_coarity();
 
-        program.append_opcode(opcode::push_constant);
-        program.append_byte(constant_index);
+    current_token = end;
 
-        current_token_ptr++;
-    } else {
-        compile_pair();
+    program.append_opcode(is_tail ? opcode::tail_call : opcode::call);
+
+    if (is_discarding())
+        program.append_opcode(opcode::pop);
+}
+
+void compiler::compile_number() {
+    uint32_t constant_index = program.add_constant(generate_number_constant());
+
+    program.append_opcode(opcode::push_constant, constant_index);
+
+    current_token++;
+}
+
+void compiler::compile_reset_or_shift(const bool is_tail) {
+    const std::string_view name = current_token.value();
+    current_token++;
+
+    push_coarity(coarity_type::one);
+
+    program.append_opcode(opcode::push_frame_index);
+    program.append_opcode(opcode::push_constant, program.push_hand_rolled_procedure(name));
+
+    push_lambda();
+
+    uint32_t argc = 0;
+    if (name == "shift") {
+        if (current_token.type() != token_type::identifier)
+            throw std::runtime_error("expected identifier in shift");
+
+        add_stack_var(current_token.value());
+        argc++;
+        current_token++;
     }
 
-    program.append_opcode(opcode::cons);
+    compile_lambda_body(argc);
+
+    pop_coarity();
+
+    program.append_opcode(is_tail ? opcode::tail_call : opcode::call);
+
+    if (is_discarding())
+        program.append_opcode(opcode::pop);
 }
 
 void compiler::compile_set() {
-    current_token_ptr++;
+    current_token++;
 
     if (eof())
         throw std::runtime_error("unexpected eof after set!");
 
-    if (current_token_ptr->type != token_type::identifier)
+    if (current_token.type() != token_type::identifier)
         throw std::runtime_error("expected identifier in set!");
 
-    const auto [var_type, var_id] = get_var_type_and_id(current_token_ptr->value);
+    const auto [var_type, var_id] = get_var_type_and_id(current_token.value());
 
     push_coarity(coarity_type::one);
 
-    current_token_ptr++;
+    current_token++;
     compile_expression();
 
     if (var_type == variable_type::stack)
-        program.append_opcode(opcode::set_stack_var);
+        program.append_opcode(opcode::set_stack_var, var_id);
     else
-        program.append_opcode(opcode::set_shared_var);
-
-    program.append_byte(var_id);
+        program.append_opcode(opcode::set_shared_var, var_id);
 
     pop_coarity();
 
+    if (!is_discarding())
+        push_unspecified();
+
     consume_token(token_type::right_paren);
 }
 
+size_t compiler::count_procedure_args() const {
+    size_t argc = 0;
+
+    for (
+        token_cursor t = skip_expression(current_token);
+        t.type() != token_type::eof and t.type() != token_type::right_paren;
+        t = skip_expression(t)
+    )
+        argc++;
+
+    return argc;
+}
+
 void compiler::consume_token(const token_type type) {
-    if (current_token_ptr->type != type)
-        throw std::runtime_error(std::format("unexpected token: {}", static_cast<uint8_t>(current_token_ptr->type)));
+    if (current_token.type() != type)
+        throw std::runtime_error(std::format("unexpected token: {}", static_cast<uint8_t>(current_token.type())));
 
-    current_token_ptr++;
+    current_token++;
 }
 
 bool compiler::eof() {
@@ -363,11 +903,11 @@ bool compiler::eof() {
 }
 
 scheme_constant compiler::generate_boolean_constant() {
-    return current_token_ptr->type == token_type::boolean_true;
+    return current_token.type() == token_type::boolean_true;
 }
 
 scheme_constant compiler::generate_number_constant() {
-    const std::string_view& sv = current_token_ptr->value;
+    const std::string_view& sv = current_token.value();
 
     if (sv.find(".") == std::string::npos) {
         int64_t int_value;
@@ -388,6 +928,63 @@ scheme_constant compiler::generate_number_constant() {
     return double_value;
 }
 
+std::optional<scheme_constant> compiler::generate_folded_constant() {
+    switch (current_token.type()) {
+        case token_type::number: {
+            const scheme_constant c = generate_number_constant();
+            current_token++;
+            return c;
+        }
+        case token_type::boolean_true:
+        case token_type::boolean_false: {
+            const scheme_constant c = generate_boolean_constant();
+            current_token++;
+            return c;
+        }
+        case token_type::left_paren:
+            break;
+        default:
+            return std::nullopt;
+    }
+
+    const token_cursor call_token = current_token;
+
+    if (const auto it = folded_calls.find(call_token.index); it != folded_calls.end()) {
+        if (it->second)
+            current_token = skip_expression(call_token);
+
+        return it->second;
+    }
+
+    const auto folded = generate_folded_call();
+    folded_calls.emplace(call_token.index, folded);
+    return folded;
+}
+
+std::optional<scheme_constant> compiler::generate_folded_call() {
+    current_token++;
+
+    if (current_token.type() != token_type::identifier or !pure_bp_names.contains(current_token.value()))
+        return std::nullopt;
+
+    const builtin_procedure bp = bp_name_to_ptr.at(current_token.value());
+    current_token++;
+
+    std::vector<scheme_constant> args;
+    while (current_token.type() != token_type::right_paren) {
+        // NOTE: this also bails out at eof, leaving the error to the regular procedure call path
+        const auto arg = generate_folded_constant();
+        if (!arg)
+            return std::nullopt;
+
+        args.emplace_back(*arg);
+    }
+
+    current_token++;
+
+    return evaluate_builtin_call(folding_vm, bp, args);
+}
+
 lambda_context& compiler::get_current_lambda() {
     if (lambda_stack.empty())
         throw std::runtime_error("no lambda context to get");
@@ -395,34 +992,47 @@ lambda_context& compiler::get_current_lambda() {
     return lambda_stack.back();
 }
 
-std::pair<variable_type, uint8_t> compiler::get_var_type_and_id(const std::string_view& name) {
+std::pair<variable_type, uint32_t> compiler::get_var_type_and_id(const std::string_view& name) {
     if (lambda_stack.empty())
         throw std::runtime_error("no lambda context to get variable from");
 
     return get_var_type_and_id(name, lambda_stack.size() - 1);
 }
 
-std::pair<variable_type, uint8_t> compiler::get_var_type_and_id(const std::string_view& name, size_t scope_depth) {
+std::pair<variable_type, uint32_t> compiler::get_var_type_and_id(const std::string_view& name, size_t scope_depth) {
     bool is_current_scope = (scope_depth == lambda_stack.size() - 1);
     auto& scope_ctx = lambda_stack[scope_depth];
 
     if (scope_ctx.stack_vars.contains(name)) {
-        uint8_t var_id = scope_ctx.stack_vars[name];
+        uint32_t var_id = scope_ctx.stack_vars[name];
 
         if (!is_current_scope) {
-            program.append_opcode(opcode::capture_stack_var, scope_depth);
-            program.append_byte(scope_ctx.stack_vars[name], scope_depth);
+            const capture_kind kind = scope_ctx.boxed_stack_vars.contains(name)
+                ? capture_kind::stack_var
+                : capture_kind::stack_value;
+
+            lambda_stack[scope_depth + 1].captures.emplace_back(make_capture_descriptor(kind, var_id));
         }
 
         return {variable_type::stack, var_id};
     }
 
     if (scope_ctx.shared_vars.contains(name)) {
-        uint8_t var_id = scope_ctx.shared_vars[name];
+        uint32_t var_id = scope_ctx.shared_vars[name];
 
         if (!is_current_scope) {
-            program.append_opcode(opcode::capture_shared_var, scope_depth);
-            program.append_byte(scope_ctx.shared_vars[name], scope_depth);
+            lambda_stack[scope_depth + 1].captures.emplace_back(make_capture_descriptor(capture_kind::shared_var, var_id));
+        }
+
+        return {variable_type::shared, var_id};
+    }
+
+    if (name == scope_ctx.self_name) {
+        scope_ctx.captures.emplace_back(make_capture_descriptor(capture_kind::self, 0));
+        uint32_t var_id = add_shared_var(name, scope_depth);
+
+        if (!is_current_scope) {
+            lambda_stack[scope_depth + 1].captures.emplace_back(make_capture_descriptor(capture_kind::shared_var, var_id));
         }
 
         return {variable_type::shared, var_id};
@@ -433,61 +1043,59 @@ std::pair<variable_type, uint8_t> compiler::get_var_type_and_id(const std::strin
 
     const auto [var_type, var_id] = get_var_type_and_id(name, scope_depth - 1);
 
-    uint8_t new_var_id = add_shared_var(name, scope_depth);
+    uint32_t new_var_id = add_shared_var(name, scope_depth);
 
     if (!is_current_scope) {
-        program.append_opcode(opcode::capture_shared_var, scope_depth);
-        program.append_byte(new_var_id, scope_depth);
+        lambda_stack[scope_depth + 1].captures.emplace_back(make_capture_descriptor(capture_kind::shared_var, new_var_id));
     }
 
     return {variable_type::shared, new_var_id};
 }
 
-void compiler::pop_coarity() {
-    auto& current_lambda_ctx = get_current_lambda();
+bool compiler::is_discarding() {
+    const auto& current_coarity_stack = get_current_lambda().coarity_stack;
 
-    if (current_lambda_ctx.coarity_stack.empty())
-        throw std::runtime_error("can't pop from empty coarity stack");
+    if (current_coarity_stack.empty())
+        throw std::runtime_error("can't check empty coarity stack");
 
-    const coarity_type old_type = current_lambda_ctx.coarity_stack.back();
-    current_lambda_ctx.coarity_stack.pop_back();
+    return current_coarity_stack.back() == coarity_type::any;
+}
 
-    if (!current_lambda_ctx.coarity_stack.empty()) {
-        const coarity_type current_type = current_lambda_ctx.coarity_stack.back();
+void compiler::pop_coarity() {
+    auto& current_coarity_stack = get_current_lambda().coarity_stack;
 
-        if (current_type != old_type)
-            program.append_opcode(current_type == coarity_type::any ? opcode::set_coarity_any : opcode::set_coarity_one);
-    }
+    if (current_coarity_stack.empty())
+        throw std::runtime_error("can't pop from empty coarity stack");
+
+    current_coarity_stack.pop_back();
 }
 
 void compiler::push_coarity(coarity_type type) {
-    auto& current_lambda_ctx = get_current_lambda();
-
-    if (
-        current_lambda_ctx.coarity_stack.empty()
-        or current_lambda_ctx.coarity_stack.back() != type
-    )
-        program.append_opcode(type == coarity_type::any ? opcode::set_coarity_any : opcode::set_coarity_one);
-
-    current_lambda_ctx.coarity_stack.emplace_back(type);
+    get_current_lambda().coarity_stack.emplace_back(type);
 }
 
 void compiler::pop_lambda() {
     // TODO: add this lambda context to the bytecode (only in debug mode, for the purpose of resolving var names in the disassembly)
+    const lambda_context ctx = std::move(lambda_stack.back());
     lambda_stack.pop_back();
     program.pop_lambda();
+
+    // NOTE: the lambda is only pushed once it's compiled, since its captures aren't known until
+    // then. Nothing else can have been appended to the enclosing lambda's block in the meantime.
+    if (lambda_stack.empty())
+        return;
+
+    if (ctx.captures.empty())
+        program.append_opcode(opcode::push_constant, ctx.lambda_constant_index);
+    else
+        program.append_make_closure(ctx.lambda_constant_index, ctx.captures);
 }
 
 void compiler::push_lambda() {
-    uint8_t lambda_constant_index = program.add_constant(lambda_constant{lambda_offset_placeholder++});
-
-    if (!lambda_stack.empty()) {
-        program.append_opcode(opcode::push_constant);
-        program.append_byte(lambda_constant_index);
-    }
+    uint32_t lambda_constant_index = program.add_constant(lambda_constant{lambda_offset_placeholder++});
 
     program.push_lambda(lambda_constant_index);
-    lambda_stack.emplace_back(lambda_context{});
+    lambda_stack.emplace_back(lambda_context{}).lambda_constant_index = lambda_constant_index;
 }
 
 void compiler::set_coarity(coarity_type type) {
@@ -496,8 +1104,9 @@ void compiler::set_coarity(coarity_type type) {
     if (current_coarity_stack.empty())
         throw std::runtime_error("can't set coarity on empty coarity stack");
 
-    if (current_coarity_stack.back() != type) {
-        program.append_opcode(type == coarity_type::any ? opcode::set_coarity_any : opcode::set_coarity_one);
-        current_coarity_stack[current_coarity_stack.size() - 1] = type;
-    }
+    current_coarity_stack.back() = type;
+}
+
+void compiler::push_unspecified() {
+    program.append_opcode(opcode::push_constant, program.add_constant(empty_list{}));
 }
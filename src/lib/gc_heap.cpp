@@ -0,0 +1,242 @@
+#include <algorithm>
+
+#include "gc_heap.hpp"
+#include "overload.hpp"
+
+gc_heap::~gc_heap() {
+    while (objects) {
+        gc_header* const next = objects->next;
+        destroy(objects);
+        objects = next;
+    }
+}
+
+void gc_heap::collect(
+    const std::vector<stack_value>& stack,
+    const std::vector<call_frame>& call_frames,
+    const continuation& frozen_stack,
+    const std::vector<stack_value>& constants
+) {
+    for (const auto& v : stack)
+        mark_value(v);
+
+    for (const auto& v : constants)
+        mark_value(v);
+
+    mark_call_frames(call_frames);
+    mark(frozen_stack.segment.block);
+    trace();
+
+    const size_t live_bytes = sweep();
+
+    // scale the next collection with the size of the live heap so that collection cost stays
+    // proportional to allocation.
+    bytes_since_collection = 0;
+    collection_threshold = std::max(min_collection_threshold, live_bytes * 2);
+}
+
+void gc_heap::add_chunk() {
+    chunks.emplace_back(new std::byte[chunk_size]);
+    chunk_cursor = chunks.back().get();
+    chunk_limit = chunk_cursor + chunk_size;
+    PLOY_GC_POISON(chunk_cursor, chunk_size);
+}
+
+void gc_heap::destroy(gc_header* const header) {
+    const size_t size_class = size_class_of(size_of(header));
+
+    switch (static_cast<kind>(header->kind)) {
+        case kind::bignum:
+            destroy_object<bignum>(header);
+            break;
+        case kind::continuation:
+            destroy_object<continuation>(header);
+            break;
+        case kind::escape_continuation:
+            destroy_object<escape_continuation>(header);
+            break;
+        case kind::lambda:
+            destroy_object<lambda>(header);
+            break;
+        case kind::pair:
+            destroy_object<pair>(header);
+            break;
+        case kind::stack_segment:
+            destroy_object<stack_segment>(header);
+            break;
+        default:
+            destroy_object<scheme_value>(header);
+            break;
+    }
+
+    auto* const cell = reinterpret_cast<free_cell*>(header);
+    cell->next = free_cells[size_class];
+    free_cells[size_class] = cell;
+
+    // the link stays accessible, the rest of the cell doesn't
+    PLOY_GC_POISON(
+        reinterpret_cast<std::byte*>(cell) + sizeof(free_cell),
+        (size_class + 1) * cell_granularity - sizeof(free_cell)
+    );
+}
+
+void gc_heap::mark(gc_header* const header) {
+    if (!header or header->marked)
+        return;
+
+    header->marked = true;
+    gray_objects.emplace_back(header);
+}
+
+void gc_heap::mark_call_frames(const std::vector<call_frame>& call_frames) {
+    for (const auto& frame : call_frames)
+        mark(frame.executing_lambda.block);
+}
+
+void gc_heap::mark_value(const stack_value& v) {
+    visit(
+        overload{
+            [this](const scheme_value_ptr& a) {
+                mark(a.block);
+            },
+            [this](const bignum_ptr& a) {
+                mark(a.block);
+            },
+            [this](const continuation_ptr& a) {
+                mark(a.block);
+            },
+            [this](const escape_continuation_ptr& a) {
+                mark(a.block);
+            },
+            [this](const lambda_ptr& a) {
+                mark(a.block);
+            },
+            [this](const pair_ptr& a) {
+                mark(a.block);
+            },
+            [](const auto&) {},
+        },
+        v
+    );
+}
+
+void gc_heap::mark_value(const scheme_value& v) {
+    visit(
+        overload{
+            [this](const bignum_ptr& a) {
+                mark(a.block);
+            },
+            [this](const continuation_ptr& a) {
+                mark(a.block);
+            },
+            [this](const escape_continuation_ptr& a) {
+                mark(a.block);
+            },
+            [this](const lambda_ptr& a) {
+                mark(a.block);
+            },
+            [this](const pair_ptr& a) {
+                mark(a.block);
+            },
+            [](const auto&) {},
+        },
+        v
+    );
+}
+
+void gc_heap::trace() {
+    // NOTE: an explicit worklist is used instead of recursion so that long lists can't overflow the
+    // native stack.
+    while (!gray_objects.empty()) {
+        gc_header* const header = gray_objects.back();
+        gray_objects.pop_back();
+
+        switch (static_cast<kind>(header->kind)) {
+            case kind::bignum:
+                break;
+            case kind::continuation:
+                mark(static_cast<gc_block<continuation>*>(header)->value.segment.block);
+                break;
+            case kind::escape_continuation:
+                break;
+            case kind::lambda:
+                for (const auto& capture : static_cast<gc_block<lambda>*>(header)->value.captures)
+                    mark_value(capture);
+
+                break;
+            case kind::pair: {
+                const auto& p = static_cast<gc_block<pair>*>(header)->value;
+                mark_value(p.car);
+                mark_value(p.cdr);
+                break;
+            }
+            case kind::stack_segment: {
+                // NOTE: the whole segment is marked even if every continuation that can reach it
+                // only views part of it.
+                const auto& segment = static_cast<gc_block<stack_segment>*>(header)->value;
+
+                for (const auto& v : segment.values)
+                    mark_value(v);
+
+                mark_call_frames(segment.call_frames);
+                mark(segment.parent.segment.block);
+                break;
+            }
+            default:
+                mark_value(static_cast<gc_block<scheme_value>*>(header)->value);
+                break;
+        }
+    }
+}
+
+size_t gc_heap::size_of(const gc_header* const header) {
+    switch (static_cast<kind>(header->kind)) {
+        case kind::bignum:
+            return sizeof(gc_block<bignum>);
+        case kind::continuation:
+            return sizeof(gc_block<continuation>);
+        case kind::escape_continuation:
+            return sizeof(gc_block<escape_continuation>);
+        case kind::lambda:
+            return sizeof(gc_block<lambda>);
+        case kind::pair:
+            return sizeof(gc_block<pair>);
+        case kind::stack_segment:
+            return sizeof(gc_block<stack_segment>);
+        default:
+            return sizeof(gc_block<scheme_value>);
+    }
+}
+
+size_t gc_heap::owned_size_of(const gc_header* const header) {
+    switch (static_cast<kind>(header->kind)) {
+        case kind::bignum:
+            return owned_size_of(static_cast<const gc_block<bignum>*>(header)->value);
+        case kind::lambda:
+            return owned_size_of(static_cast<const gc_block<lambda>*>(header)->value);
+        case kind::stack_segment:
+            return owned_size_of(static_cast<const gc_block<stack_segment>*>(header)->value);
+        default:
+            return 0;
+    }
+}
+
+size_t gc_heap::sweep() {
+    size_t live_bytes = 0;
+    gc_header** link = &objects;
+
+    while (*link) {
+        gc_header* const header = *link;
+
+        if (header->marked) {
+            header->marked = false;
+            live_bytes += size_of(header) + owned_size_of(header);
+            link = &header->next;
+        } else {
+            *link = header->next;
+            destroy(header);
+        }
+    }
+
+    return live_bytes;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <compare>
+#include <limits>
+#include <optional>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+ * Arbitrary-precision integer. Exact integer arithmetic that overflows a fixnum is redone with
+ * bignums, and results that fit in a fixnum again are demoted back to one, so a bignum scheme value
+ * always holds an integer outside of the fixnum range.
+ *
+ * The magnitude is stored as 32-bit limbs, least significant first, without any most significant
+ * zero limbs. Zero has no limbs and is never negative. Multiplication switches from the schoolbook
+ * method to Karatsuba's method once both operands are long enough for it to pay off.
+ */
+struct bignum {
+    std::vector<uint32_t> limbs;
+    bool negative = false;
+
+    bignum() = default;
+    explicit bignum(const int64_t v);
+
+    /**
+     * Returns this bignum as an int64_t if it fits in one.
+     */
+    std::optional<int64_t> to_int64() const;
+
+    /**
+     * Returns the double nearest to this bignum.
+     */
+    double to_double() const;
+
+    /**
+     * Returns the decimal representation of this bignum.
+     */
+    std::string to_string() const;
+
+    bool is_odd() const {
+        return !limbs.empty() and (limbs.front() & 1);
+    }
+
+    bignum operator-() const;
+
+    friend bignum operator+(const bignum& a, const bignum& b);
+    friend bignum operator-(const bignum& a, const bignum& b);
+    friend bignum operator*(const bignum& a, const bignum& b);
+
+    /**
+     * Truncating division, same as for fixnums. Throws on division by zero.
+     */
+    friend bignum operator/(const bignum& a, const bignum& b);
+
+    friend std::strong_ordering operator<=>(const bignum& a, const bignum& b);
+    friend bool operator==(const bignum& a, const bignum& b) = default;
+};
+
+// The following return true if the result of the operation overflows, like the GCC and Clang
+// builtins that they use where available. The result is only valid if there was no overflow.
+
+inline bool add_overflow(const int64_t a, const int64_t b, int64_t& result) {
+#ifdef __GNUC__
+    return __builtin_add_overflow(a, b, &result);
+#else
+    if ((b > 0 and a > std::numeric_limits<int64_t>::max() - b) or (b < 0 and a < std::numeric_limits<int64_t>::min() - b))
+        return true;
+
+    result = a + b;
+    return false;
+#endif
+}
+
+inline bool sub_overflow(const int64_t a, const int64_t b, int64_t& result) {
+#ifdef __GNUC__
+    return __builtin_sub_overflow(a, b, &result);
+#else
+    if ((b < 0 and a > std::numeric_limits<int64_t>::max() + b) or (b > 0 and a < std::numeric_limits<int64_t>::min() + b))
+        return true;
+
+    result = a - b;
+    return false;
+#endif
+}
+
+inline bool mul_overflow(const int64_t a, const int64_t b, int64_t& result) {
+#ifdef __GNUC__
+    return __builtin_mul_overflow(a, b, &result);
+#else
+    constexpr int64_t max = std::numeric_limits<int64_t>::max();
+    constexpr int64_t min = std::numeric_limits<int64_t>::min();
+
+    if (a > 0 ? (b > 0 ? a > max / b : b < min / a) : (b > 0 ? a < min / b : a != 0 and b < max / a))
+        return true;
+
+    result = a * b;
+    return false;
+#endif
+}
@@ -1,9 +1,11 @@
 #pragma once
 
 #include <array>
+#include <span>
 #include <stdint.h>
 #include <string>
 #include <string.h>
+#include <type_traits>
 #include <unordered_map>
 #include <vector>
 
@@ -29,28 +31,29 @@ enum class opcode : uint8_t {
     call,
 
     /**
-     * Capture a shared variable from the currently executing lambda to the lambda on the stack
-     * top. Has one argument that is an index into the lambdas shared variables indicating the
-     * variable to capture.
+     * Replace the pair at the stack top with its car. Dedicated version of the car builtin (see
+     * bp_name_to_opcode).
      */
-    capture_shared_var,
+    car,
 
     /**
-     * Capture a stack variable. Has one argument that is an index into the currently executing
-     * lambda's stack variables indicating the variable to capture.
-     *
-     * NOTE: when a lambda captures itself, the stack var count will not be updated until after the
-     * capture, making the var index arg for this opcode technically out of bounds. This is okay for
-     * now since the stack var count is only used when lambdas return.
+     * Replace the pair at the stack top with its cdr. Dedicated version of the cdr builtin.
      */
-    capture_stack_var,
+    cdr,
 
     /**
      * Replace the top two stack values with a pair containing those stack values, where the cdr is
-     * the stack top.
+     * the stack top. Also serves as the dedicated version of the cons builtin.
      */
     cons,
 
+    /**
+     * Replace the top two stack values with the result of comparing them with =. This and the other
+     * dedicated builtin opcodes have an inline fixnum fast path and fall back to calling the
+     * builtin procedure for any other operand types.
+     */
+    equal_numeric,
+
     /**
      * Check to make sure that argc for the currently executing lambda is as expected. Only needed
      * for lambdas that have a fixed number of args. The one argument for this opcode is the argc to
@@ -58,11 +61,30 @@ enum class opcode : uint8_t {
      */
     expect_argc,
 
+    /**
+     * Replace the top two stack values with the result of comparing them with >.
+     */
+    greater,
+
+    /**
+     * Replace the top two stack values with the result of comparing them with >=.
+     */
+    greater_equal,
+
     /**
      * Halt the vm.
      */
     halt,
 
+    /**
+     * Loop back to an earlier point in the executing lambda, which is always right after its argc
+     * check. Like tail_call, the values above the executing lambda's stack vars replace them as its
+     * new args, except that the call frame and the lambda stay as they are. Used for self tail calls
+     * of named let and do loops. See jump_forward for jump offset format, where the offset is
+     * subtracted instead of added.
+     */
+    jump_backward,
+
     /**
      * Unconditional jump forward. The jump offset is store in 4 bytes directly after this opcode.
      * Currently the endianness is platform dependent, but if we ever want platform-independent
@@ -76,9 +98,59 @@ enum class opcode : uint8_t {
      */
     jump_forward_if_not,
 
+    /**
+     * Replace the top two stack values with the result of comparing them with <.
+     */
+    less,
+
+    /**
+     * Replace the top two stack values with the result of comparing them with <=.
+     */
+    less_equal,
+
+    /**
+     * Push a new lambda with captured variables. The args are the index of the lambda's
+     * lambda_constant, the number of captures, and then one capture descriptor per capture (see
+     * capture_kind), in the order of the new lambda's shared vars. Unlike other opcodes, the size of
+     * this one depends on its args (see bytecode::get_instruction_size). A wide prefix widens all of
+     * the args.
+     *
+     * NOTE: a lambda that captures itself (i.e. one that's the init expression of a define) captures
+     * the stack slot it's pushed to. This slot is technically past the executing lambda's stack vars
+     * until the define's add_stack_var, which is okay since the stack var count is only used when
+     * lambdas return.
+     */
+    make_closure,
+
+    /**
+     * Replace the top two stack values with their difference.
+     */
+    minus,
+
+    /**
+     * Replace the top two stack values with their product.
+     */
+    multiply,
+
+    /**
+     * Replace the stack top with a boolean indicating whether or not it is the empty list.
+     */
+    null,
+
+    /**
+     * Replace the top two stack values with their sum.
+     */
+    plus,
+
+    /**
+     * Discard the value at the stack top.
+     */
+    pop,
+
     /**
      * Push a constant from the bytecode's constants vector to the top of the stack. The one byte
-     * arg is an index into the constants vector.
+     * arg is an index into the constants vector. A lambda constant is only pushed this way if the
+     * lambda has no captures, and like a hand-rolled procedure, it's the same lambda on every push.
      */
     push_constant,
 
@@ -88,12 +160,26 @@ enum class opcode : uint8_t {
      */
     push_continuation,
 
+    /**
+     * Push an escape continuation object to the stack that escapes to the current lambda call.
+     * Used by call/ec, which must store the object as its second stack var (see
+     * escape_continuation).
+     */
+    push_escape_continuation,
+
     /**
      * Create a new call frame at the current stack top and push it to the call frame stack. The
      * call frame keeps track of a procedure's or lambda's arguments.
      */
     push_frame_index,
 
+    /**
+     * Push a prompt to the stack, which marks the current lambda call as the delimiter of the
+     * continuations captured by shift. Used by reset, which must store the prompt as its second
+     * stack var.
+     */
+    push_prompt,
+
     /**
      * Push a shared var identified by the opcode's one byte argument from the currently executing
      * lambda's shared var list to the stack top.
@@ -107,21 +193,11 @@ enum class opcode : uint8_t {
     push_stack_var,
 
     /**
-     * Pop the current call frame, roll the return value(s) down over the call frame's position on
-     * the stack, and return to the called position.
+     * Pop the current call frame, roll the return value down over the call frame's position on the
+     * stack, and return to the called position.
      */
     ret,
 
-    /**
-     * Set coarity state in vm to coarity_type::any.
-     */
-    set_coarity_any,
-
-    /**
-     * Set coarity state in vm to coarity_type::one.
-     */
-    set_coarity_one,
-
     /**
      * Set the value of a shared var identified by the opcode's one byte argument to the value at
      * the stack top.
@@ -133,6 +209,29 @@ enum class opcode : uint8_t {
      * the stack top.
      */
     set_stack_var,
+
+    /**
+     * Capture the delimited continuation up to the nearest prompt and abort to that prompt. The
+     * executing call frame becomes the return point of the prompt's call, and the captured
+     * continuation is pushed to the stack. Used by shift, which must have its procedure arg as its
+     * only stack var.
+     */
+    shift,
+
+    /**
+     * Like call, but for a call in tail position. If the callable is a lambda, the current call
+     * frame is popped and the callable and its args are moved down the stack over the executing
+     * lambda's frame, which is then reused for the new lambda. This keeps both stacks from growing
+     * during tail recursion. Any other callable is called as with the call opcode.
+     */
+    tail_call,
+
+    /**
+     * Prefix that widens the one byte arg of the opcode directly after it to four bytes (see
+     * opcode_wide). The compiler only emits it when an arg doesn't fit in one byte, e.g. for the
+     * 256th constant of a program.
+     */
+    wide,
 };
 
 /**
@@ -150,6 +249,73 @@ struct opcode_one_arg {
     uint8_t arg;
 };
 
+/**
+ * Represents the size and layout of a make_closure opcode with one-byte args, which is followed by
+ * capture_count one-byte capture descriptors.
+ */
+struct opcode_make_closure {
+    uint8_t opcode_value;
+    uint8_t lambda_constant_index;
+    uint8_t capture_count;
+};
+
+/**
+ * Identifies where a variable captured by make_closure comes from. Stored in the low bits of a
+ * capture descriptor, with the variable's index in the rest (see make_capture_descriptor).
+ */
+enum class capture_kind : uint8_t {
+
+    /**
+     * The new lambda itself, which is how a named let's lambda refers to itself by name. The
+     * variable index is unused.
+     */
+    self,
+
+    /**
+     * A shared var of the executing lambda, which is copied as is (i.e. whether it's a box or a
+     * value).
+     */
+    shared_var,
+
+    /**
+     * A stack var that's never assigned with set!, whose value is copied.
+     */
+    stack_value,
+
+    /**
+     * A stack var that's assigned with set!. It's moved into a box (if it isn't in one already)
+     * that's shared by its stack slot and the new lambda.
+     */
+    stack_var,
+};
+
+/**
+ * Number of low bits of a capture descriptor that hold its capture_kind.
+ */
+inline constexpr uint32_t capture_kind_bits = 2;
+
+/**
+ * Packs the given capture kind and variable index into a capture descriptor.
+ */
+constexpr uint32_t make_capture_descriptor(const capture_kind kind, const uint32_t var_index) {
+    return var_index << capture_kind_bits | static_cast<uint32_t>(kind);
+}
+
+/**
+ * The type of the arg of an opcode following a wide prefix.
+ */
+using wide_arg_type = uint32_t;
+
+/**
+ * Represents the size and layout of a wide prefix, the opcode it applies to, and that opcode's
+ * widened argument.
+ */
+struct opcode_wide {
+    uint8_t wide_value;
+    uint8_t opcode_value;
+    uint8_t arg[sizeof(wide_arg_type)];
+};
+
 /**
  * The type used for jump offsets embedded into the byte as jump opcode arguments.
  */
@@ -185,25 +351,77 @@ struct opcode_info {
 inline constexpr auto opcode_infos = std::to_array<opcode_info>({
     {"add_stack_var", sizeof(opcode_no_arg)},
     {"call", sizeof(opcode_no_arg)},
-    {"capture_shared_var", sizeof(opcode_one_arg)},
-    {"capture_stack_var", sizeof(opcode_one_arg)},
+    {"car", sizeof(opcode_no_arg)},
+    {"cdr", sizeof(opcode_no_arg)},
     {"cons", sizeof(opcode_no_arg)},
+    {"equal_numeric", sizeof(opcode_no_arg)},
     {"expect_argc", sizeof(opcode_one_arg)},
+    {"greater", sizeof(opcode_no_arg)},
+    {"greater_equal", sizeof(opcode_no_arg)},
     {"halt", sizeof(opcode_no_arg)},
+    {"jump_backward", sizeof(opcode_jump)},
     {"jump_forward", sizeof(opcode_jump)},
     {"jump_forward_if_not", sizeof(opcode_jump)},
+    {"less", sizeof(opcode_no_arg)},
+    {"less_equal", sizeof(opcode_no_arg)},
+    {"make_closure", sizeof(opcode_make_closure)},
+    {"minus", sizeof(opcode_no_arg)},
+    {"multiply", sizeof(opcode_no_arg)},
+    {"null", sizeof(opcode_no_arg)},
+    {"plus", sizeof(opcode_no_arg)},
+    {"pop", sizeof(opcode_no_arg)},
     {"push_constant", sizeof(opcode_one_arg)},
     {"push_continuation", sizeof(opcode_no_arg)},
+    {"push_escape_continuation", sizeof(opcode_no_arg)},
     {"push_frame_index", sizeof(opcode_no_arg)},
+    {"push_prompt", sizeof(opcode_no_arg)},
     {"push_shared_var", sizeof(opcode_one_arg)},
     {"push_stack_var", sizeof(opcode_one_arg)},
     {"ret", sizeof(opcode_no_arg)},
-    {"set_coarity_any", sizeof(opcode_no_arg)},
-    {"set_coarity_one", sizeof(opcode_no_arg)},
     {"set_shared_var", sizeof(opcode_one_arg)},
     {"set_stack_var", sizeof(opcode_one_arg)},
+    {"shift", sizeof(opcode_no_arg)},
+    {"tail_call", sizeof(opcode_no_arg)},
+    {"wide", sizeof(opcode_wide)},
 });
 
+/**
+ * Layout of the header at the start of a serialized bytecode file (see bytecode::serialize). The
+ * header is followed by the constants and then the code. Like jump offsets, all multi-byte values
+ * in the file use the platform's endianness.
+ */
+struct bytecode_file_header {
+
+    /**
+     * Always bytecode_file_magic. Identifies the file as serialized bytecode rather than scheme
+     * source.
+     */
+    std::array<uint8_t, 8> magic;
+
+    /**
+     * Fingerprint of the file format and of everything the bytecode depends on in the ploy build that
+     * wrote it (see bytecode::get_fingerprint). A file can only be loaded by a build with the same
+     * fingerprint.
+     */
+    uint64_t fingerprint;
+
+    /**
+     * Number of constants following the header.
+     */
+    uint64_t constant_count;
+
+    /**
+     * Size in bytes of the code following the constants.
+     */
+    uint64_t code_size;
+};
+
+/**
+ * Magic bytes that start every serialized bytecode file. The leading byte can't start a scheme
+ * source file.
+ */
+inline constexpr std::array<uint8_t, 8> bytecode_file_magic{0x7f, 'p', 'l', 'o', 'y', 'b', 'c', 0};
+
 /**
  * Temporary structure for holding the bytecode of a lambda before it is concatenated to the final
  * bytecode array. Also contains the lambda_constant id it is associated with.
@@ -213,7 +431,7 @@ inline constexpr auto opcode_infos = std::to_array<opcode_info>({
  */
 struct lambda_code {
     std::vector<uint8_t> code;
-    uint8_t lambda_constant_id;
+    uint32_t lambda_constant_id;
 };
 
 /**
@@ -230,7 +448,7 @@ struct bytecode {
      * Adds a new scheme constant and returns its id to be used in the bytecode, or returns id of
      * existing constant.
      */
-    uint8_t add_constant(const scheme_constant& new_constant);
+    uint32_t add_constant(const scheme_constant& new_constant);
 
     /**
      * Append given byte to the current compiling block.
@@ -252,6 +470,30 @@ struct bytecode {
      */
     void append_opcode(opcode value, size_t scope_depth);
 
+    /**
+     * Append given opcode and its one arg to the current compiling block. The opcode is prefixed
+     * with wide if the arg doesn't fit in one byte.
+     */
+    void append_opcode(opcode value, uint32_t arg);
+
+    /**
+     * Append given opcode and its one arg to the compiling block specified by scope depth.
+     */
+    void append_opcode(opcode value, uint32_t arg, size_t scope_depth);
+
+    /**
+     * Append a make_closure opcode for the lambda with the given constant and capture descriptors
+     * to the current compiling block. The opcode is prefixed with wide if any arg doesn't fit in one
+     * byte.
+     */
+    void append_make_closure(uint32_t lambda_constant_index, const std::span<const uint32_t> capture_descriptors);
+
+    /**
+     * Append a jump_backward opcode to the current compiling block that jumps to the given bytecode
+     * index of that block (see get_block_size).
+     */
+    void append_jump_backward(const size_t dest_index);
+
     /**
      * Backpatch a previously prepared jump offset at the given bytecode index of the current
      * compiling block.
@@ -263,15 +505,56 @@ struct bytecode {
      */
     void concat_blocks();
 
+    /**
+     * Loads bytecode from the given serialized bytecode file contents. Throws if the file is
+     * malformed or was written by an incompatible build.
+     */
+    static bytecode deserialize(const std::span<const uint8_t> bytes);
+
     /**
      * Return the disassembly of this bytecode object as a string.
      */
     std::string disassemble() const;
 
+    /**
+     * Returns the size of the current compiling block, which is the bytecode index that the next
+     * appended opcode will be at.
+     */
+    size_t get_block_size() const;
+
     /**
      * Get the scheme constant specified by its id.
      */
-    const scheme_constant& get_constant(uint8_t index) const;
+    const scheme_constant& get_constant(uint32_t index) const;
+
+    /**
+     * Get the number of scheme constants.
+     */
+    uint32_t get_constant_count() const;
+
+    /**
+     * Returns the size in bytes of the instruction at the given pointer, including its args and any
+     * wide prefix.
+     */
+    static size_t get_instruction_size(const uint8_t* const instruction);
+
+    /**
+     * Returns the fingerprint written to and checked against serialized bytecode files. It's a hash
+     * of the file format version, the opcodes and the hand-rolled procedures' code, so bytecode
+     * written by a build whose bytecode is incompatible with this one's is never loaded.
+     */
+    static uint64_t get_fingerprint();
+
+    /**
+     * Returns the 64-bit FNV-1a hash of the given bytes. Unlike std::hash, this is stable across
+     * builds, so it can key files on disk.
+     */
+    static uint64_t hash(const std::span<const uint8_t> bytes);
+
+    /**
+     * Returns true if the given bytes start like a serialized bytecode file.
+     */
+    static bool is_serialized(const std::span<const uint8_t> bytes);
 
     /**
      * Reserve space for a jump opcode and its offset arg and return the bytecode offset where the
@@ -289,20 +572,20 @@ struct bytecode {
     /**
      * Pushes a hand-rolled procedure to the compiled blocks stack. Returns the associated constant id.
      */
-    uint8_t push_hand_rolled_procedure(const std::string_view& name);
+    uint32_t push_hand_rolled_procedure(const std::string_view& name);
 
     /**
      * Push a new compiling block onto the stack. lambda_constant_index is the constant associated
      * with this block.
      */
-    void push_lambda(uint8_t lambda_constant_index);
+    void push_lambda(uint32_t lambda_constant_index);
 
     /**
      * Read a value of type T located at the given byte array pointer.
      */
     template <typename T>
     static constexpr T read_value(const uint8_t* const ptr) {
-        if constexpr (sizeof(T) == 1)
+        if constexpr (sizeof(T) == 1 and std::is_integral_v<T>)
             return *ptr;
 
         T value;
@@ -310,6 +593,13 @@ struct bytecode {
         return value;
     }
 
+    /**
+     * Returns this bytecode in the serialized bytecode file format. Builtin procedures, hand-rolled
+     * procedures and symbols are stored by name and resolved again by deserialize, since their
+     * addresses differ from run to run.
+     */
+    std::vector<uint8_t> serialize() const;
+
     std::string to_string() const;
 
     /**
@@ -317,7 +607,7 @@ struct bytecode {
      */
     template <typename T>
     static constexpr void write_value(T value, uint8_t* const ptr) {
-        if constexpr (sizeof(T) == 1) {
+        if constexpr (sizeof(T) == 1 and std::is_integral_v<T>) {
             *ptr = value;
             return;
         }
@@ -335,7 +625,7 @@ struct bytecode {
     /**
      * Maps constants to their index in the constants array.
      */
-    std::unordered_map<scheme_constant, uint8_t> constant_to_index_map;
+    std::unordered_map<scheme_constant, uint32_t> constant_to_index_map;
 
     /**
      * Stack of compiling code blocks.
@@ -346,4 +636,9 @@ struct bytecode {
      * Stack of compiled code blocks.
      */
     std::vector<lambda_code> compiled_blocks;
+
+    /**
+     * Append given opcode and its one arg to the given code, prefixed with wide if needed.
+     */
+    static void append_opcode(std::vector<uint8_t>& code, opcode value, uint32_t arg);
 };
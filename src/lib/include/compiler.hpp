@@ -1,11 +1,38 @@
 #pragma once
 
+#include <optional>
 #include <stdint.h>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
 #include "bytecode.hpp"
 #include "tokenizer.hpp"
+#include "virtual_machine.hpp"
+
+/**
+ * Enum that represents the continuation arity (coarity) of a given expression (i.e. the number of
+ * values expected as results of the expression). Coarity is resolved entirely at compile time: an
+ * expression compiled with a coarity of one leaves exactly one value on the stack, and an expression
+ * compiled with a coarity of any leaves nothing.
+ */
+enum class coarity_type {
+
+    /**
+     * Any number of values can result from the expression, and they will be discarded. Pure
+     * expressions aren't compiled at all, and other results are popped. Used for all non-final
+     * expressions of an expression sequence (e.g. a begin expression, a lambda body, etc.).
+     */
+    any,
+
+    /**
+     * Exactly one value is expected as a result of the expression. Used when evaluating procedure
+     * call arguments, if conditions, etc.
+     */
+    one,
+};
 
 enum class variable_type {
     stack,
@@ -23,30 +50,107 @@ struct lambda_context {
     /**
      * Maps a stack variable's name to its id used in the bytecode.
      */
-    std::unordered_map<std::string_view, uint8_t> stack_vars;
+    std::unordered_map<std::string_view, uint32_t> stack_vars;
 
     /**
      * Maps a shared (i.e. captured) variable's name to its id used in the bytecode.
      */
-    std::unordered_map<std::string_view, uint8_t> shared_vars;
+    std::unordered_map<std::string_view, uint32_t> shared_vars;
 
     /**
-     * Stack of coarity_types that tell the compiler which coarity toggle to add to the bytecode.
+     * Names of the stack variables that have to be boxed when captured, since they might change
+     * after a lambda captures them. All other stack variables are captured by value.
+     */
+    std::unordered_set<std::string_view> boxed_stack_vars;
+
+    /**
+     * Stack of coarity_types that tell the compiler whether the expression being compiled should
+     * leave a value on the stack.
      */
      std::vector<coarity_type> coarity_stack;
+
+    /**
+     * Capture descriptors of the lambda's shared vars, in the order of their ids (see
+     * make_closure). Filled in as the lambda's body refers to variables of enclosing lambdas.
+     */
+    std::vector<uint32_t> captures;
+
+    /**
+     * Index of the lambda's lambda_constant.
+     */
+    uint32_t lambda_constant_index;
+
+    /**
+     * Name that the lambda's body refers to the lambda itself by if it's the lambda of a named let,
+     * or empty otherwise. Like any other variable, it's shadowed by the lambda's stack vars.
+     */
+    std::string_view self_name;
+
+    /**
+     * Number of args the lambda expects.
+     */
+    uint32_t argc = 0;
+
+    /**
+     * Bytecode index in the lambda's block right after its argc check, which is where loops jump
+     * back to (see jump_backward).
+     */
+    size_t loop_index = 0;
 };
 
 struct compiler {
     bytecode program;
 
-    compiler(const std::vector<token>& tokens);
+    /**
+     * Compiles the program read by the given tokenizer.
+     */
+    compiler(tokenizer& t);
 
     protected:
     std::vector<lambda_context> lambda_stack;
-    const token* current_token_ptr;
+    token_cursor current_token;
     size_t lambda_offset_placeholder;
 
-    uint8_t add_shared_var(const std::string_view& var_name, size_t scope_depth);
+    /**
+     * Names of the variables assigned with set! anywhere in the top-level expression being
+     * compiled. Since a name is all that's checked, this also covers variables of the same name
+     * that are never actually assigned, which only means they're boxed needlessly.
+     */
+    std::unordered_set<std::string_view> assigned_vars;
+
+    /**
+     * Results of the calls folded so far in the top-level expression being compiled, keyed by the
+     * token index of their left paren, with nothing for calls that can't be folded. Folding is
+     * tried again on each nested call of a call that can't be folded, so this keeps every call
+     * from being evaluated more than once.
+     */
+    std::unordered_map<size_t, std::optional<scheme_constant>> folded_calls;
+
+    /**
+     * Scratch vm that folded calls are evaluated on (see evaluate_builtin_call).
+     */
+    virtual_machine folding_vm;
+
+    /**
+     * Set right before compiling an expression in tail position. Consumed (and reset) by
+     * compile_expression so that it never leaks into subexpressions.
+     */
+    bool tail_position = false;
+
+    /**
+     * Adds the datum starting at the current token as a constant and returns its index. Quoted
+     * lists become pair constants, so a quoted datum is built once when the program is loaded
+     * rather than every time it's evaluated.
+     */
+    uint32_t add_datum_constant();
+
+    /**
+     * Adds the rest of the list whose left paren was just consumed as a constant and returns its
+     * index (see add_datum_constant).
+     */
+    uint32_t add_list_constant();
+
+    uint32_t add_shared_var(const std::string_view& var_name, size_t scope_depth);
     void add_stack_var(const std::string_view& var_name);
 
     /**
@@ -54,34 +158,88 @@ struct compiler {
      */
     template <token_type TokenType>
     bool at_sentinel() {
-        return current_token_ptr->type == TokenType;
+        return current_token.type() == TokenType;
     }
 
+    /**
+     * Compiles the argc check at the start of the current lambda's body, which is also where the
+     * lambda's loops jump back to.
+     */
+    void compile_argc_check(const uint32_t argc);
+
     void compile_boolean();
+
+    /**
+     * Compiles a call to a builtin procedure as its dedicated opcode. The current token must be the
+     * builtin's name, and the number of args must match the opcode's argc. If the result is
+     * discarded, the opcode is only left out if it can't fail.
+     */
+    void compile_builtin_opcode(const opcode op);
+
     void compile_define();
+
+    /**
+     * Compiles a do loop, (do ((var init step)...) (test result...) command...), as a call to a
+     * lambda whose args are the loop vars. Each iteration evaluates the steps and jumps back to the
+     * start of the lambda with them as the new args, so the whole loop runs in one call frame.
+     */
+    void compile_do(const bool is_tail);
     void compile_expression();
     void compile_external_representation();
     void compile_external_representation_abbr();
     void compile_identifier();
-    void compile_if();
+    void compile_if(const bool is_tail);
     void compile_lambda();
+
+    /**
+     * Compiles the body of the lambda on the top of the lambda stack, whose args have already been
+     * added as stack vars, and pops the lambda.
+     */
+    void compile_lambda_body(const uint32_t argc);
+
+    /**
+     * Compiles a let or named let form as a call to a lambda made from its body, whose args are the
+     * let's vars. For a named let, the name is the lambda's self_name, and calls to it in tail
+     * position of the body jump back to the start of the lambda instead of making a new call.
+     *
+     * NOTE: a named let's name can't be assigned with set!, since the lambda captures itself by
+     * value.
+     */
+    void compile_let(const bool is_tail);
+
+    /**
+     * Compiles a call to the lambda of a let or do form that was just compiled, with the inits of
+     * the bindings starting at the given token as args. The current token is left where it was.
+     */
+    void compile_let_call(const token_cursor bindings, const bool is_tail);
+
     void compile_number();
-    void compile_pair();
-    void compile_procedure_call();
+    void compile_procedure_call(const bool is_tail);
+
+    /**
+     * Compiles a reset form, (reset body...), or a shift form, (shift k body...), as a call to the
+     * hand-rolled procedure of the same name with a lambda made from the body. For shift, k is the
+     * lambda's one arg.
+     */
+    void compile_reset_or_shift(const bool is_tail);
+
     void compile_set();
 
     /**
      * Compiles a sequence of expressions. If FinalCoarity is one, results from all but the last
-     * expression in the sequence will be discarded, otherwise results from all expressions will be
-     * discarded. Used for expressions in the global scope, lambda bodies, begin expressions, etc.
+     * expression in the sequence will be discarded, and the last expression is compiled in tail
+     * position. Otherwise results from all expressions will be discarded. Used for expressions in
+     * the global scope, lambda bodies, begin expressions, etc.
      */
     template <coarity_type FinalCoarity, auto... SentinelChecks>
     void compile_expression_sequence() {
         if constexpr (FinalCoarity == coarity_type::one) {
-            if (current_token_ptr->is_final)
+            if (current_token.is_final()) {
                 push_coarity(coarity_type::one);
-            else
+                tail_position = true;
+            } else {
                 push_coarity(coarity_type::any);
+            }
         } else {
             push_coarity(coarity_type::any);
         }
@@ -90,8 +248,10 @@ struct compiler {
 
         while ((!(this->*SentinelChecks)() and ...)) {
             if constexpr (FinalCoarity == coarity_type::one) {
-                if (current_token_ptr->is_final)
+                if (current_token.is_final()) {
                     set_coarity(coarity_type::one);
+                    tail_position = true;
+                }
             }
 
             compile_expression();
@@ -102,12 +262,33 @@ struct compiler {
 
     void consume_token(const token_type type);
 
+    /**
+     * Counts the args of the procedure call whose procedure expression is the current token,
+     * without consuming any tokens.
+     */
+    size_t count_procedure_args() const;
+
     /**
      * Check if current token is the eof token type.
      */
     bool eof();
 
     scheme_constant generate_boolean_constant();
+
+    /**
+     * Evaluates the expression at the current token at compile time if it's a literal or a call to
+     * a pure builtin procedure whose args can all be evaluated this way, e.g. (+ 1 (* 2 3)). Advances
+     * past the expression and returns its value on success. Returns nothing otherwise, in which case
+     * the current token is left somewhere inside the expression.
+     */
+    std::optional<scheme_constant> generate_folded_constant();
+
+    /**
+     * Like generate_folded_constant, but for the call whose left paren is the current token, and
+     * without looking up or recording the result in folded_calls.
+     */
+    std::optional<scheme_constant> generate_folded_call();
+
     scheme_constant generate_number_constant();
 
     /**
@@ -115,8 +296,13 @@ struct compiler {
      */
     lambda_context& get_current_lambda();
 
-    std::pair<variable_type, uint8_t> get_var_type_and_id(const std::string_view& name);
-    std::pair<variable_type, uint8_t> get_var_type_and_id(const std::string_view& name, size_t scope_depth);
+    std::pair<variable_type, uint32_t> get_var_type_and_id(const std::string_view& name);
+    std::pair<variable_type, uint32_t> get_var_type_and_id(const std::string_view& name, size_t scope_depth);
+
+    /**
+     * Checks if the result of the expression being compiled will be discarded.
+     */
+    bool is_discarding();
 
     /**
      * Pop value from coarity stack.
@@ -124,8 +310,7 @@ struct compiler {
     void pop_coarity();
 
     /**
-     * Push value to the coarity stack. If the value passed is the same as the stack top, no
-     * bytecode will be emitted.
+     * Push value to the coarity stack.
      */
     void push_coarity(coarity_type type);
 
@@ -133,8 +318,13 @@ struct compiler {
     void push_lambda();
 
     /**
-     * Set value of the coarity stack top. If the value passed is the same as the stack top, no
-     * bytecode will be emitted.
+     * Emits a push of the value used for expressions whose result is unspecified (e.g. set!). This
+     * is currently the empty list.
+     */
+    void push_unspecified();
+
+    /**
+     * Set value of the coarity stack top.
      */
     void set_coarity(coarity_type type);
 };
@@ -0,0 +1,275 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <new>
+#include <stddef.h>
+#include <stdint.h>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "scheme_value.hpp"
+
+// When built with AddressSanitizer, free cells and unused chunk memory are poisoned so that use
+// after free of heap objects is still caught even though cells never go back to the system
+// allocator.
+#if defined(__SANITIZE_ADDRESS__)
+#define PLOY_GC_ASAN
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define PLOY_GC_ASAN
+#endif
+#endif
+
+#ifdef PLOY_GC_ASAN
+#include <sanitizer/asan_interface.h>
+#define PLOY_GC_POISON(ptr, size) ASAN_POISON_MEMORY_REGION(ptr, size)
+#define PLOY_GC_UNPOISON(ptr, size) ASAN_UNPOISON_MEMORY_REGION(ptr, size)
+#else
+#define PLOY_GC_POISON(ptr, size) ((void)(ptr), (void)(size))
+#define PLOY_GC_UNPOISON(ptr, size) ((void)(ptr), (void)(size))
+#endif
+
+/**
+ * Owns every heap-allocated scheme object (pairs, lambdas, continuations, their stack segments,
+ * escape continuations and boxed variables) and frees them with a precise mark and sweep
+ * collection. Unlike reference counting, this handles cyclic structures such as recursive closures.
+ *
+ * The heap doesn't know where its roots are, so it never collects on its own. Instead, the owner
+ * checks should_collect before allocating and calls collect with its roots. This means objects are
+ * only ever freed at allocation points, and an object only has to be reachable from a root at those
+ * points.
+ *
+ * Memory for objects comes from large chunks rather than from the general-purpose allocator. New
+ * objects are bump allocated from the current chunk, so consecutively allocated objects (e.g. the
+ * cells of a list) are adjacent in memory. Since the collector never moves objects, the cells freed
+ * by a sweep are kept on free lists segregated by size, and allocation reuses those before bumping.
+ */
+struct gc_heap {
+
+    /**
+     * Identifies the type of a heap allocation, stored in its gc_header.
+     */
+    enum class kind : uint8_t {
+        bignum,
+        box,
+        continuation,
+        escape_continuation,
+        lambda,
+        pair,
+        stack_segment,
+    };
+
+    gc_heap() = default;
+    gc_heap(const gc_heap&) = delete;
+    gc_heap& operator=(const gc_heap&) = delete;
+    ~gc_heap();
+
+    /**
+     * Allocates a new garbage-collected T. The object lives until the first collection that can't
+     * reach it.
+     */
+    template <typename T, typename... Args>
+    gc_ptr<T> make(Args&&... args) {
+        constexpr size_t size_class = size_class_of(sizeof(gc_block<T>));
+        static_assert(size_class < size_class_count, "heap object too large for its size class");
+        static_assert(alignof(gc_block<T>) <= cell_granularity);
+
+        auto* const block = new (allocate_cell(size_class)) gc_block<T>(std::forward<Args>(args)...);
+        bytes_since_collection += owned_size_of(block->value);
+
+        block->kind = static_cast<uint8_t>(kind_of<T>());
+        block->next = objects;
+        objects = block;
+
+        return gc_ptr<T>{block};
+    }
+
+    /**
+     * Checks if enough has been allocated since the last collection that another one is due.
+     */
+    bool should_collect() const {
+#ifdef PLOY_GC_STRESS
+        return true;
+#else
+        return bytes_since_collection >= collection_threshold;
+#endif
+    }
+
+    /**
+     * Frees every object not reachable from the given roots. frozen_stack is the continuation
+     * below the given stacks, and constants are the values of the executing program's constants.
+     */
+    void collect(
+        const std::vector<stack_value>& stack,
+        const std::vector<call_frame>& call_frames,
+        const continuation& frozen_stack,
+        const std::vector<stack_value>& constants
+    );
+
+    protected:
+
+    /**
+     * Minimum number of bytes allocated between collections.
+     */
+    static constexpr size_t min_collection_threshold = size_t{1} << 20;
+
+    /**
+     * Object sizes are rounded up to a multiple of this, which is also the alignment of every cell.
+     */
+    static constexpr size_t cell_granularity = 16;
+
+    static constexpr size_t size_class_count = 8;
+    static constexpr size_t chunk_size = size_t{1} << 18;
+
+    /**
+     * A cell on one of the free lists.
+     */
+    struct free_cell {
+        free_cell* next;
+    };
+
+    /**
+     * Returns the index of the free list for cells that can hold an object of the given size.
+     */
+    static constexpr size_t size_class_of(const size_t size) {
+        return (size + cell_granularity - 1) / cell_granularity - 1;
+    }
+
+    /**
+     * Chunks that cells are bump allocated from. Chunks are only released when the heap is
+     * destroyed.
+     */
+    std::vector<std::unique_ptr<std::byte[]>> chunks;
+
+    std::byte* chunk_cursor = nullptr;
+    std::byte* chunk_limit = nullptr;
+
+    /**
+     * Heads of the free lists, indexed by size class.
+     */
+    std::array<free_cell*, size_class_count> free_cells{};
+
+    /**
+     * Head of the list of all allocations owned by this heap.
+     */
+    gc_header* objects = nullptr;
+
+    size_t bytes_since_collection = 0;
+    size_t collection_threshold = min_collection_threshold;
+
+    /**
+     * Marked objects whose references haven't been traced yet. Kept as a member so that its
+     * storage is reused across collections.
+     */
+    std::vector<gc_header*> gray_objects;
+
+    template <typename T>
+    static constexpr kind kind_of() {
+        if constexpr (std::is_same_v<T, bignum>)
+            return kind::bignum;
+        else if constexpr (std::is_same_v<T, continuation>)
+            return kind::continuation;
+        else if constexpr (std::is_same_v<T, escape_continuation>)
+            return kind::escape_continuation;
+        else if constexpr (std::is_same_v<T, lambda>)
+            return kind::lambda;
+        else if constexpr (std::is_same_v<T, pair>)
+            return kind::pair;
+        else if constexpr (std::is_same_v<T, stack_segment>)
+            return kind::stack_segment;
+        else
+            return kind::box;
+    }
+
+    /**
+     * Returns memory for a cell of the given size class, preferring freed cells over bump
+     * allocation.
+     */
+    void* allocate_cell(const size_t size_class) {
+        const size_t cell_size = (size_class + 1) * cell_granularity;
+        bytes_since_collection += cell_size;
+
+        if (free_cell* const cell = free_cells[size_class]) {
+            free_cells[size_class] = cell->next;
+            PLOY_GC_UNPOISON(cell, cell_size);
+            return cell;
+        }
+
+        if (static_cast<size_t>(chunk_limit - chunk_cursor) < cell_size)
+            add_chunk();
+
+        void* const cell = chunk_cursor;
+        chunk_cursor += cell_size;
+        PLOY_GC_UNPOISON(cell, cell_size);
+        return cell;
+    }
+
+    /**
+     * Starts bump allocating from a new chunk. Whatever was left in the previous chunk is wasted.
+     */
+    void add_chunk();
+
+    /**
+     * Destroys the given object according to its kind and puts its cell on the matching free list.
+     */
+    void destroy(gc_header* header);
+
+    /**
+     * Destroys the given object without reclaiming its cell.
+     */
+    template <typename T>
+    static void destroy_object(gc_header* const header) {
+        static_cast<gc_block<T>*>(header)->~gc_block<T>();
+    }
+
+    /**
+     * Marks the given allocation as reachable and queues it for tracing.
+     */
+    void mark(gc_header* header);
+
+    void mark_call_frames(const std::vector<call_frame>& call_frames);
+    void mark_value(const stack_value& v);
+    void mark_value(const scheme_value& v);
+
+    /**
+     * Returns the size of the given allocation according to its kind.
+     */
+    static size_t size_of(const gc_header* header);
+
+    /**
+     * Returns the number of bytes that the given object owns outside of its cell, such as the limbs
+     * of a bignum. These count towards collection pacing just like cells do, since otherwise a few
+     * large objects could pile up a lot of memory between collections. The counted vectors are
+     * never resized after the object is made.
+     */
+    template <typename T>
+    static size_t owned_size_of(const T& v) {
+        if constexpr (std::is_same_v<T, bignum>)
+            return v.limbs.capacity() * sizeof(uint32_t);
+        else if constexpr (std::is_same_v<T, lambda>)
+            return v.captures.capacity() * sizeof(stack_value);
+        else if constexpr (std::is_same_v<T, stack_segment>)
+            return v.call_frames.capacity() * sizeof(call_frame) + v.values.capacity() * sizeof(stack_value);
+        else
+            return 0;
+    }
+
+    /**
+     * Returns the number of bytes that the given allocation owns outside of its cell according to
+     * its kind.
+     */
+    static size_t owned_size_of(const gc_header* header);
+
+    /**
+     * Marks everything reachable from the objects queued by mark.
+     */
+    void trace();
+
+    /**
+     * Frees all unmarked objects and clears the marks on the rest. Returns the number of bytes
+     * still in use.
+     */
+    size_t sweep();
+};
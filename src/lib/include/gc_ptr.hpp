@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <stdint.h>
+#include <utility>
+
+/**
+ * Header placed at the start of every garbage-collected heap allocation. Every allocation is linked
+ * into its gc_heap's object list through this header, which is how the sweep phase finds unmarked
+ * objects. Since the header is common to all heap types, a reference to any heap object is a single
+ * pointer, which is what allows heap references to be packed into a nan_boxed_value.
+ */
+struct gc_header {
+
+    /**
+     * Next allocation in the owning gc_heap's object list.
+     */
+    gc_header* next;
+
+    /**
+     * Identifies the type of the allocation (see gc_heap::kind). Set by the owning gc_heap.
+     */
+    uint8_t kind;
+
+    /**
+     * Set during the mark phase of a collection if the allocation is reachable.
+     */
+    bool marked;
+};
+
+/**
+ * A heap allocation holding a garbage-collected value of type T.
+ */
+template <typename T>
+struct gc_block : gc_header {
+    T value;
+
+    template <typename... Args>
+    gc_block(Args&&... args) : gc_header{nullptr, 0, false}, value(std::forward<Args>(args)...) {}
+};
+
+/**
+ * Non-owning pointer to a garbage-collected value. The allocation is owned by a gc_heap, which frees
+ * it once a collection finds it unreachable, so copies are just pointer copies.
+ */
+template <typename T>
+struct gc_ptr {
+    gc_ptr() = default;
+
+    gc_ptr(std::nullptr_t) {}
+
+    explicit gc_ptr(gc_block<T>* const block) : block{block} {}
+
+    T* get() const {
+        return block ? &block->value : nullptr;
+    }
+
+    T& operator*() const {
+        return block->value;
+    }
+
+    T* operator->() const {
+        return &block->value;
+    }
+
+    explicit operator bool() const {
+        return block != nullptr;
+    }
+
+    bool operator==(const gc_ptr& other) const {
+        return block == other.block;
+    }
+
+    /**
+     * The underlying allocation, or nullptr if this pointer is empty.
+     */
+    gc_block<T>* block = nullptr;
+};
+
+static_assert(
+    sizeof(gc_ptr<gc_header>) == sizeof(void*),
+    "heap references must stay a single word so that copying scheme values never touches the heap"
+);
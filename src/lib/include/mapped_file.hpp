@@ -0,0 +1,38 @@
+#pragma once
+
+#include <span>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Read-only memory mapping of a whole file. The contents are paged in by the os as they're touched
+ * instead of being read into a buffer up front. An empty file has no mapping and an empty span of
+ * bytes.
+ */
+struct mapped_file {
+
+    /**
+     * Maps the file at the given path. Throws if the file can't be opened or mapped.
+     */
+    mapped_file(const char* const file_path);
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    ~mapped_file();
+
+    std::span<const uint8_t> bytes() const {
+        return {data, size};
+    }
+
+    protected:
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+
+#ifdef _WIN32
+    /**
+     * Handle of the file mapping object, which must be kept open for as long as the view is mapped.
+     */
+    void* mapping_handle = nullptr;
+#endif
+};
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <bit>
+#include <concepts>
+#include <optional>
+#include <stdexcept>
+#include <stdint.h>
+#include <type_traits>
+
+#include "gc_ptr.hpp"
+
+// NOTE: this header is included by scheme_value.hpp once the basic scheme value types (and the
+// heap types' forward declarations and gc_ptr aliases) have been declared. It isn't meant to be
+// included on its own. Anything that needs the complete heap types (the heap reference
+// constructors, visit and get_if) is defined at the bottom of scheme_value.hpp.
+
+static_assert(sizeof(void*) == 8, "nan boxing requires 64-bit pointers");
+
+/**
+ * Scheme value packed into a single 64-bit word. Used in place of the std::variant based
+ * scheme_value when ploy is built with PLOY_NAN_BOXING (see nan_boxed_stack_value for the
+ * stack_value counterpart).
+ *
+ * Flonums are stored as plain doubles. Every other type is a negative NaN bit pattern: the top 12
+ * bits (the sign and exponent) are all set, the next 4 bits are a type tag, and the low 48 bits are
+ * the payload. The tag's top bit is the double's quiet bit, so tags 8 and up are quiet NaNs and
+ * tags 1-7 are signaling NaNs, which is fine since these bits are never used as a double. Real NaNs
+ * are canonicalized to a positive quiet NaN so they can never collide with a tagged value, and tag
+ * 0 is never used so that negative infinity stays a flonum. This makes every type test a single
+ * mask-and-compare (or just a compare for flonums).
+ *
+ * Fixnums are 48-bit signed integers (larger integers are bignums). Heap references point at the
+ * gc_header of their allocation. Since the heap is garbage collected, copying a value is just
+ * copying the word. Symbols store the address of their interned name, whose length is stored
+ * right before it, so decoding one doesn't have to scan the name.
+ */
+struct nan_boxed_value {
+
+    /**
+     * Type tag stored in bits 48-51. Tags at or above bignum are heap references. The box tag
+     * is only ever used by nan_boxed_stack_value.
+     */
+    enum class tag : uint64_t {
+        fixnum = 1,
+        boolean,
+        empty_list,
+        symbol,
+        builtin_procedure,
+        bignum,
+        continuation,
+        escape_continuation,
+        lambda,
+        pair,
+        box,
+    };
+
+    static constexpr uint64_t payload_mask = (uint64_t{1} << 48) - 1;
+    static constexpr uint64_t tag_mask = ~payload_mask;
+    static constexpr uint64_t canonical_nan = 0x7ff8'0000'0000'0000;
+    static constexpr int64_t fixnum_max = (int64_t{1} << 47) - 1;
+    static constexpr int64_t fixnum_min = -(int64_t{1} << 47);
+
+    /**
+     * Returns the bits common to every value of the given tag.
+     */
+    static constexpr uint64_t tag_bits(const tag t) {
+        return (uint64_t{0xfff0} | static_cast<uint64_t>(t)) << 48;
+    }
+
+    /**
+     * Checks if the given integer can be stored as a fixnum.
+     */
+    static constexpr bool fits_fixnum(const int64_t v) {
+        return v >= fixnum_min and v <= fixnum_max;
+    }
+
+    uint64_t bits;
+
+    nan_boxed_value() : bits{tag_bits(tag::fixnum)} {}
+
+    nan_boxed_value(const int64_t v) {
+        if (!fits_fixnum(v))
+            throw std::runtime_error("integer out of fixnum range");
+
+        bits = tag_bits(tag::fixnum) | (static_cast<uint64_t>(v) & payload_mask);
+    }
+
+    nan_boxed_value(const double v)
+        : bits{v != v ? canonical_nan : std::bit_cast<uint64_t>(v)} {}
+
+    nan_boxed_value(const bool v) : bits{tag_bits(tag::boolean) | v} {}
+
+    nan_boxed_value(const builtin_procedure v)
+        : bits{tag_bits(tag::builtin_procedure) | reinterpret_cast<uint64_t>(v)} {}
+
+    nan_boxed_value(const empty_list) : bits{tag_bits(tag::empty_list)} {}
+
+    nan_boxed_value(const symbol& v)
+        : bits{tag_bits(tag::symbol) | reinterpret_cast<uint64_t>(v.interned_name.data())} {}
+
+    nan_boxed_value(const bignum_ptr& v);
+    nan_boxed_value(const continuation_ptr& v);
+    nan_boxed_value(const escape_continuation_ptr& v);
+    nan_boxed_value(const lambda_ptr& v);
+    nan_boxed_value(const pair_ptr& v);
+
+    /**
+     * Returns the type tag of this value. Only meaningful if this value isn't a flonum.
+     */
+    tag get_tag() const {
+        return static_cast<tag>((bits >> 48) & 0xf);
+    }
+
+    /**
+     * Checks if this value holds the given type.
+     */
+    template <typename T>
+    bool holds() const {
+        if constexpr (std::is_same_v<T, double>)
+            return bits < tag_bits(tag::fixnum);
+        else
+            return (bits & tag_mask) == tag_bits(tag_of<T>());
+    }
+
+    /**
+     * Decodes this value as the given type. The caller must have already checked the type.
+     */
+    template <typename T>
+    decltype(auto) get() const {
+        if constexpr (std::is_same_v<T, int64_t>)
+            return static_cast<int64_t>(bits << 16) >> 16;
+        else if constexpr (std::is_same_v<T, double>)
+            return std::bit_cast<double>(bits);
+        else if constexpr (std::is_same_v<T, bool>)
+            return (bits & payload_mask) != 0;
+        else if constexpr (std::is_same_v<T, builtin_procedure>)
+            return reinterpret_cast<builtin_procedure>(bits & payload_mask);
+        else if constexpr (std::is_same_v<T, empty_list>)
+            return empty_list{};
+        else if constexpr (std::is_same_v<T, symbol>)
+            return symbol::from_interned_name(reinterpret_cast<const char*>(bits & payload_mask));
+        else
+            return T{static_cast<decltype(T::block)>(heap_header())};
+    }
+
+    protected:
+
+    nan_boxed_value(const tag t, gc_header* const header)
+        : bits{tag_bits(t) | reinterpret_cast<uint64_t>(header)} {}
+
+    template <typename T>
+    static constexpr tag tag_of() {
+        if constexpr (std::is_same_v<T, int64_t>)
+            return tag::fixnum;
+        else if constexpr (std::is_same_v<T, bool>)
+            return tag::boolean;
+        else if constexpr (std::is_same_v<T, empty_list>)
+            return tag::empty_list;
+        else if constexpr (std::is_same_v<T, symbol>)
+            return tag::symbol;
+        else if constexpr (std::is_same_v<T, builtin_procedure>)
+            return tag::builtin_procedure;
+        else if constexpr (std::is_same_v<T, bignum_ptr>)
+            return tag::bignum;
+        else if constexpr (std::is_same_v<T, continuation_ptr>)
+            return tag::continuation;
+        else if constexpr (std::is_same_v<T, escape_continuation_ptr>)
+            return tag::escape_continuation;
+        else if constexpr (std::is_same_v<T, lambda_ptr>)
+            return tag::lambda;
+        else if constexpr (std::is_same_v<T, pair_ptr>)
+            return tag::pair;
+        else
+            return tag::box;
+    }
+
+    gc_header* heap_header() const {
+        return reinterpret_cast<gc_header*>(bits & payload_mask);
+    }
+};
+
+static_assert(sizeof(nan_boxed_value) == sizeof(uint64_t));
+static_assert(std::is_trivially_copyable_v<nan_boxed_value>);
+
+/**
+ * The stack_value counterpart of nan_boxed_value. The only difference is that this type can also
+ * hold a box, i.e. a heap-allocated scheme_value created when a lambda captures a stack variable.
+ */
+struct nan_boxed_stack_value : nan_boxed_value {
+    using nan_boxed_value::nan_boxed_value;
+
+    nan_boxed_stack_value() = default;
+
+    nan_boxed_stack_value(const nan_boxed_value& v) : nan_boxed_value{v} {}
+
+    nan_boxed_stack_value(const gc_ptr<nan_boxed_value>& v) : nan_boxed_value{tag::box, v.block} {}
+};
+
+static_assert(sizeof(nan_boxed_stack_value) == sizeof(uint64_t));
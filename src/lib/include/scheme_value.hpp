@@ -1,18 +1,20 @@
 #pragma once
 
-#include <memory>
+#include <cstring>
 #include <stdint.h>
 #include <string_view>
 #include <variant>
 #include <vector>
 
+#include "bignum.hpp"
+#include "gc_ptr.hpp"
 #include "template_appender.hpp"
 
 /**
  * Represents a natively-implemented procedure available to scheme programs. Any standard procedure
  * required by scheme can be a builtin_procedure provided that it doesn't need to call lambdas.
  */
-using builtin_procedure = void (*)(void*, uint8_t);
+using builtin_procedure = void (*)(void*, uint32_t);
 
 /**
  * Represents the empty list scheme object.
@@ -20,9 +22,60 @@ using builtin_procedure = void (*)(void*, uint8_t);
 using empty_list = uint8_t;
 
 /**
- * Represents a scheme symbol object.
+ * Represents a scheme symbol object. Symbols are interned (see symbol::intern), so there is exactly
+ * one name per distinct symbol for the lifetime of the process. Two symbols are the same symbol if
+ * and only if they point at the same name, which makes comparing and hashing symbols O(1) and lets
+ * symbols outlive the source they were read from.
  */
-using symbol = std::string_view;
+struct symbol {
+
+    /**
+     * View of this symbol's interned name. Interned names are stored right after their length, so a
+     * nan-boxed symbol only has to store the address of the name's characters (see
+     * from_interned_name).
+     *
+     * NOTE: the view keeps a symbol two words wide on purpose. With a one-word symbol, the
+     * std::variant scheme_value shrinks to 16 bytes, which GCC copies with byte stores followed by
+     * 16-byte loads that stall store forwarding on every push and visit.
+     */
+    std::string_view interned_name;
+
+    std::string_view name() const {
+        return interned_name;
+    }
+
+    /**
+     * Returns the symbol with the given name, interning the name first if this is the first time
+     * it has been seen. The symbol table isn't synchronized, so this should only be called from one
+     * thread at a time.
+     */
+    static symbol intern(const std::string_view name);
+
+    /**
+     * Returns the symbol whose interned name starts at the given address, reading the name's length
+     * from right before it.
+     */
+    static symbol from_interned_name(const char* const name) {
+        size_t size;
+        std::memcpy(&size, name - sizeof(size), sizeof(size));
+        return symbol{{name, size}};
+    }
+
+    bool operator==(const symbol& other) const {
+        return interned_name.data() == other.interned_name.data();
+    }
+};
+
+/**
+ * std::hash specialization for unordered_map key support. Since symbols are interned, only the
+ * address of the name needs to be hashed.
+ */
+template<>
+struct std::hash<symbol> {
+    auto operator()(const symbol& v) const {
+        return std::hash<const char*>{}(v.interned_name.data());
+    }
+};
 
 /**
  * This variant contains all common types used by the other variants that deal with scheme objects.
@@ -105,6 +158,34 @@ struct std::hash<lambda_constant> {
     }
 };
 
+/**
+ * Scheme constant type used by the compiler to represent a pair in quoted data. The car and cdr are
+ * indexes of other constants of the same bytecode, which always come before the pair, so a quoted
+ * list is a chain of these ending in an empty list constant. Since constants are deduplicated,
+ * quoted data can share structure, which is fine because quoted data is immutable.
+ */
+struct pair_constant {
+    uint32_t car_index;
+    uint32_t cdr_index;
+
+    /**
+     * Equality overload for unordered_map key support.
+     */
+    auto operator==(const pair_constant& other) const {
+        return car_index == other.car_index and cdr_index == other.cdr_index;
+    }
+};
+
+/**
+ * std::hash specialization for unordered_map key support.
+ */
+template<>
+struct std::hash<pair_constant> {
+    auto operator()(const pair_constant& v) const {
+        return std::hash<uint64_t>{}(uint64_t{v.car_index} << 32 | v.cdr_index);
+    }
+};
+
 /**
  * Represents a constant scheme value. These values are generated by the compiler as it encounters
  * them in the scheme source.
@@ -112,17 +193,50 @@ struct std::hash<lambda_constant> {
 using scheme_constant = template_appender<
     scheme_value_base,
     hand_rolled_procedure_constant,
-    lambda_constant
+    lambda_constant,
+    pair_constant
 >::type;
 
+using bignum_ptr = gc_ptr<bignum>;
+
 struct continuation;
-using continuation_ptr = std::shared_ptr<continuation>;
+using continuation_ptr = gc_ptr<continuation>;
+
+struct escape_continuation;
+using escape_continuation_ptr = gc_ptr<escape_continuation>;
+
+struct stack_segment;
+using stack_segment_ptr = gc_ptr<stack_segment>;
 
 struct lambda;
-using lambda_ptr = std::shared_ptr<lambda>;
+using lambda_ptr = gc_ptr<lambda>;
 
 struct pair;
-using pair_ptr = std::shared_ptr<pair>;
+using pair_ptr = gc_ptr<pair>;
+
+#ifdef PLOY_NAN_BOXING
+
+#include "nan_boxed_value.hpp"
+
+/**
+ * Represents a runtime scheme value. See nan_boxed_value for the packed representation.
+ */
+using scheme_value = nan_boxed_value;
+
+/**
+ * Represents a heap-allocated scheme variable (a box). These are created when lambdas capture stack
+ * variables that are assigned with set!.
+ */
+using scheme_value_ptr = gc_ptr<scheme_value>;
+
+/**
+ * Represents a scheme value that exists on the stack. Normally stack_values are one of the types
+ * contained in scheme values, but when a lambda captures a stack_value that's assigned with set!,
+ * it replaces it with a scheme_value_ptr.
+ */
+using stack_value = nan_boxed_stack_value;
+
+#else
 
 /**
  * Represents a runtime scheme value. These are generally not used directly (see scheme_value_ptr
@@ -130,46 +244,30 @@ using pair_ptr = std::shared_ptr<pair>;
  */
 using scheme_value = template_appender<
     scheme_value_base,
+    bignum_ptr,
     continuation_ptr,
+    escape_continuation_ptr,
     lambda_ptr,
     pair_ptr
 >::type;
 
 /**
- * Represents a reference-counted scheme variable. These are created when lambdas capture stack
- * variables.
+ * Represents a heap-allocated scheme variable (a box). These are created when lambdas capture stack
+ * variables that are assigned with set!.
  */
-using scheme_value_ptr = std::shared_ptr<scheme_value>;
+using scheme_value_ptr = gc_ptr<scheme_value>;
 
 /**
  * Represents a scheme value that exists on the stack. Normally stack_values are one of the types
- * contained in scheme values, but when a lambda captures a stack_value, it replaces it with a
- * scheme_value_ptr.
+ * contained in scheme values, but when a lambda captures a stack_value that's assigned with set!,
+ * it replaces it with a scheme_value_ptr.
  */
 using stack_value = template_appender<
     scheme_value,
     scheme_value_ptr
 >::type;
 
-/**
- * Enum that represents how the vm should handle the continuation arity (coarity) of a given
- * expression (i.e. the number of values expected as results of the expression).
- */
-enum class coarity_type {
-
-    /**
-     * Any number of values can result from the expression, and they will be discarded. Used for all
-     * non-final expressions of an expression sequence (e.g. a begin expression, a lambda body,
-     * etc.).
-     */
-    any,
-
-    /**
-     * Exactly one value is expected as a result of the expression. Used when evaluating procedure
-     * call arguments, if conditions, etc.
-     */
-    one,
-};
+#endif
 
 /**
  * Structure for keeping track of calls in the vm.
@@ -199,12 +297,13 @@ struct call_frame {
      * argument count for the procedure right when it is called, but it can be incremented in the
      * middle of execution as more stack vars are added.
      */
-    uint8_t stack_var_count;
+    uint32_t stack_var_count;
 
     /**
-     * Holds the coarity state that the vm was in when this lambda was called.
+     * Index in the call frame stack of the call frame that was executing when this lambda was
+     * called, which becomes the executing call frame again on return.
      */
-    coarity_type return_coarity_state;
+    size_t return_call_frame_index;
 };
 
 /**
@@ -214,26 +313,79 @@ struct call_frame {
  * context is abandoned and the program continues from the saved context inside the continuation.
  * Continuations may even be called several times, continuing on with the exact same context each
  * time.
+ *
+ * The saved context is a view of the bottom part of a frozen stack_segment (and, through the
+ * segment's parent, of every segment below it). Since frozen segments are never modified, any
+ * number of continuations can share them without copying.
  */
 struct continuation {
 
     /**
-     * Copy of the vm's call frame stack at the moment the continuation is instantiated.
+     * Topmost segment of this continuation. Empty if there is nothing to continue with.
      */
-    std::vector<call_frame> frozen_call_frame_stack;
+    stack_segment_ptr segment;
 
     /**
-     * Copy of the vm's value stack at the moment the continuation is instantiated.
+     * Number of call frames at the bottom of the segment that are part of this continuation.
      */
-    std::vector<stack_value> frozen_value_stack;
+    size_t call_frame_count;
 
     /**
-     * Copy of the vm's coarity_state at the moment the continuation is instantiated.
-     *
-     * NOTE: since we had to add the return coarity state to call frames for lambdas, it's possible
-     * that saving the coarity state here is entirely redundant.
+     * Number of values at the bottom of the segment that are part of this continuation.
+     */
+    size_t value_count;
+
+    /**
+     * Segment index of the call frame that was executing when this continuation was frozen. It
+     * becomes the executing call frame again when the continuation is resumed.
      */
-    coarity_type frozen_coarity_state;
+    size_t executing_call_frame_index;
+
+    /**
+     * True if this is a delimited continuation captured by shift. Its segment holds the call frames
+     * from a reset call up to the shift call, and calling it pushes a copy of them onto the stacks
+     * instead of replacing the stacks.
+     */
+    bool composable = false;
+};
+
+/**
+ * Frozen piece of the vm's call frame stack and value stack. The vm freezes its stacks into a new
+ * segment when a continuation is captured, and copies pieces of segments back into its stacks one
+ * executing call frame at a time when it returns into (or resumes) a continuation. Call frame and
+ * value stack indices in a segment are relative to that segment.
+ */
+struct stack_segment {
+    std::vector<call_frame> call_frames;
+    std::vector<stack_value> values;
+
+    /**
+     * The continuation that this segment sits on top of.
+     */
+    continuation parent;
+};
+
+/**
+ * Structure that represents an escape continuation, which is a one-shot continuation that can only
+ * be used to return from the call/ec call that created it while that call is still on the stack.
+ * Unlike a full continuation, nothing is frozen when it's created, and calling it just truncates
+ * the stacks back to the call/ec call frame. That call frame is found by looking down the stacks
+ * for the nearest call/ec call frame that holds the escape continuation as its second stack var,
+ * since delimited continuations can put a copy of it at any depth.
+ */
+struct escape_continuation {
+
+    /**
+     * True if this is the prompt of a reset call rather than a call/ec escape continuation. Prompts
+     * are never handed to scheme code; they only mark where shift captures up to.
+     */
+    bool is_prompt = false;
+
+    /**
+     * Bytecode offset of the call/ec procedure. The escape continuation can be passed to any lambda
+     * as its second arg, so only call frames executing this code can be the call/ec call frame.
+     */
+    size_t bytecode_offset = 0;
 };
 
 /**
@@ -244,9 +396,11 @@ struct continuation {
 struct lambda {
 
     /**
-     * Array of variables that this lambda has captured.
+     * Array of variables that this lambda has captured. Variables that are assigned with set! are
+     * captured as a scheme_value_ptr shared with the variable's stack slot, and all others are
+     * captured as a copy of their value.
      */
-    std::vector<scheme_value_ptr> captures;
+    std::vector<stack_value> captures;
 
     /**
      * Location in the bytecode where the lambda implementation begins.
@@ -257,10 +411,94 @@ struct lambda {
 /**
  * Structure for scheme pair types. Car is the first element in the pair, and cdr is the second
  * element.
- *
- * TODO: need to handle reference cycles properly to prevent memory leaks.
  */
 struct pair {
     scheme_value car;
     scheme_value cdr;
 };
+
+#ifdef PLOY_NAN_BOXING
+
+inline nan_boxed_value::nan_boxed_value(const bignum_ptr& v) : nan_boxed_value{tag::bignum, v.block} {}
+inline nan_boxed_value::nan_boxed_value(const continuation_ptr& v) : nan_boxed_value{tag::continuation, v.block} {}
+inline nan_boxed_value::nan_boxed_value(const escape_continuation_ptr& v) : nan_boxed_value{tag::escape_continuation, v.block} {}
+inline nan_boxed_value::nan_boxed_value(const lambda_ptr& v) : nan_boxed_value{tag::lambda, v.block} {}
+inline nan_boxed_value::nan_boxed_value(const pair_ptr& v) : nan_boxed_value{tag::pair, v.block} {}
+
+/**
+ * Calls the visitor with the decoded contents of the given value, analogous to std::visit.
+ */
+template <typename Visitor>
+decltype(auto) visit(Visitor&& visitor, const nan_boxed_value& v) {
+    using tag = nan_boxed_value::tag;
+
+    if (v.holds<double>())
+        return visitor(v.get<double>());
+
+    switch (v.get_tag()) {
+        case tag::fixnum:
+            return visitor(v.get<int64_t>());
+        case tag::boolean:
+            return visitor(v.get<bool>());
+        case tag::empty_list:
+            return visitor(v.get<empty_list>());
+        case tag::symbol:
+            return visitor(v.get<symbol>());
+        case tag::builtin_procedure:
+            return visitor(v.get<builtin_procedure>());
+        case tag::bignum:
+            return visitor(v.get<bignum_ptr>());
+        case tag::continuation:
+            return visitor(v.get<continuation_ptr>());
+        case tag::escape_continuation:
+            return visitor(v.get<escape_continuation_ptr>());
+        case tag::lambda:
+            return visitor(v.get<lambda_ptr>());
+        default:
+            return visitor(v.get<pair_ptr>());
+    }
+}
+
+/**
+ * Version of visit for stack values, which can also hold a scheme_value_ptr.
+ */
+template <typename Visitor>
+decltype(auto) visit(Visitor&& visitor, const nan_boxed_stack_value& v) {
+    if (v.holds<scheme_value_ptr>())
+        return visitor(v.get<scheme_value_ptr>());
+
+    return visit(visitor, static_cast<const nan_boxed_value&>(v));
+}
+
+/**
+ * Binary version of visit.
+ */
+template <typename Visitor, typename A, typename B>
+requires std::derived_from<A, nan_boxed_value> and std::derived_from<B, nan_boxed_value>
+decltype(auto) visit(Visitor&& visitor, const A& a, const B& b) {
+    return visit(
+        [&visitor, &b](const auto& a) {
+            return visit(
+                [&visitor, &a](const auto& b) {
+                    return visitor(a, b);
+                },
+                b
+            );
+        },
+        a
+    );
+}
+
+/**
+ * Returns the decoded contents of the given value if it holds the given type, analogous to
+ * std::get_if.
+ */
+template <typename T>
+std::optional<T> get_if(const nan_boxed_value* const v) {
+    if (!v->holds<T>())
+        return std::nullopt;
+
+    return v->get<T>();
+}
+
+#endif
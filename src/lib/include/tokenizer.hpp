@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -8,7 +10,7 @@
  * Identifies the type of a token. A token is a semantic piece of the source
  * code, similar to words and punctuation in human language.
  */
-enum class token_type {
+enum class token_type : uint8_t {
 
     /**
      * Generally denotes the beginning of a compound expression or pair literal.
@@ -66,60 +68,162 @@ enum class token_type {
     eof,
 };
 
+struct token_cursor;
+
 /**
- * Holds the type and value of a token.
+ * Holds the types and values of an array of tokens as parallel arrays. Rather than holding a
+ * string_view, each token's value is an offset and size relative to the start of the source, and
+ * its type and flags are packed into one byte, so a token takes 9 bytes instead of 32. The values
+ * point to their locations in the source code rather than containing a copy.
  */
-struct token {
+struct token_stream {
 
     /**
-     * The string value of this token. The value points to its location in the source code rather
-     * than containing a copy.
+     * Start of the source that token value offsets are relative to.
      */
-    std::string_view value;
+    const char* source = nullptr;
 
     /**
-     * The type of this token.
+     * Adds a token with the given type and the value from first to last.
      */
-    token_type type;
+    void add(const char* const first, const char* const last, const token_type type) {
+        offsets.emplace_back(static_cast<uint32_t>(first - source));
+        sizes.emplace_back(static_cast<uint32_t>(last - first));
+        types_and_flags.emplace_back(static_cast<uint8_t>(type));
+    }
 
     /**
-     * Signifies whether or not this token is the beginning of the final expression in an expression
-     * sequence. Used by the compiler to properly handle continuation arity of lambda bodies.
+     * Returns a cursor at the first token.
      */
-    bool is_final = false;
+    token_cursor begin() const;
+
+    void clear() {
+        offsets.clear();
+        sizes.clear();
+        types_and_flags.clear();
+    }
 
     /**
-     * Initializes token value based on size.
+     * Signifies whether or not the given token is the beginning of the final expression in an
+     * expression sequence. Used by the compiler to properly handle continuation arity of lambda
+     * bodies.
      */
-    token(const char* const first, size_t size, const token_type type)
-        : value{first, size}, type{type} {}
+    bool is_final(const size_t index) const {
+        return types_and_flags[index] & final_flag;
+    }
+
+    void set_final(const size_t index) {
+        types_and_flags[index] |= final_flag;
+    }
+
+    size_t size() const {
+        return types_and_flags.size();
+    }
+
+    token_type type(const size_t index) const {
+        return static_cast<token_type>(types_and_flags[index] & ~final_flag);
+    }
 
     /**
-     * Initializes token value based on first and last character positions.
+     * The string value of the given token.
      */
-    token(const char* const first, const char* const last, const token_type type)
-        : value{first, last}, type{type} {}
+    std::string_view value(const size_t index) const {
+        return {source + offsets[index], sizes[index]};
+    }
+
+    protected:
+
+    /**
+     * Flag bit in types_and_flags that is set for final tokens (see is_final). The other bits hold
+     * the token_type.
+     */
+    static constexpr uint8_t final_flag = 0x80;
+
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> sizes;
+    std::vector<uint8_t> types_and_flags;
+};
+
+/**
+ * Lightweight position in a token_stream that the compiler uses to walk the tokens. Cursors can be
+ * moved and compared like pointers.
+ */
+struct token_cursor {
+    const token_stream* stream;
+    size_t index;
+
+    token_type type() const {
+        return stream->type(index);
+    }
+
+    std::string_view value() const {
+        return stream->value(index);
+    }
+
+    bool is_final() const {
+        return stream->is_final(index);
+    }
+
+    token_cursor& operator++() {
+        index++;
+        return *this;
+    }
+
+    token_cursor operator++(int) {
+        const token_cursor previous = *this;
+        index++;
+        return previous;
+    }
+
+    token_cursor operator+(const size_t n) const {
+        return {stream, index + n};
+    }
+
+    token_cursor operator-(const size_t n) const {
+        return {stream, index - n};
+    }
+
+    auto operator<=>(const token_cursor& other) const {
+        return index <=> other.index;
+    }
+
+    bool operator==(const token_cursor& other) const {
+        return index == other.index;
+    }
 };
 
+inline token_cursor token_stream::begin() const {
+    return {this, 0};
+}
+
 /**
- * Tokenizes! Takes a source string representing a scheme program and generates
- * an array of semantic tokens representative of the input program. Must be
- * constructed with a source string, after which the tokens field can be passed
- * to the compiler. All add* functions add a token to the token vector and
- * advance to the next character in the source.
+ * Tokenizes! Takes a source string representing a scheme program and generates arrays of semantic
+ * tokens representative of the input program, one top-level expression at a time. Each call to
+ * read_expression replaces the tokens field with the next top-level expression's tokens, which can
+ * then be compiled before the next one is read, so only one top-level expression's worth of tokens
+ * exists at a time no matter how large the source is. All add* functions add a token to the token
+ * vector and advance to the next character in the source.
  */
 struct tokenizer {
 
     /**
-     * Array of tokens generated from the source string. Note that this relies on the source string
-     * not being destroyed during the lifetime of this object.
+     * Tokens of the most recently read top-level expression, followed by an eof token. Note that
+     * this relies on the source string not being destroyed during the lifetime of this object.
+     */
+    token_stream tokens;
+
+    /**
+     * Prepares to generate tokens from the given source string, which doesn't need to be null
+     * terminated. Throws if the source is too large for token value offsets.
      */
-    std::vector<token> tokens;
+    tokenizer(const std::string_view source);
 
     /**
-     * Generate tokens from source string.
+     * Generates the tokens of the next top-level expression in the source, replacing the current
+     * tokens. Returns false if there are no more expressions, in which case tokens only holds an eof
+     * token. Throws if the source has no expressions at all.
      */
-    tokenizer(const char* const source);
+    bool read_expression();
 
     /**
      * Prints token array (output is currently ass since I haven't bothered with making string
@@ -130,16 +234,33 @@ struct tokenizer {
     protected:
 
     /**
-     * Holds the current position of the source file during tokenization. Should only be used inside
-     * the constructor.
+     * Holds the current position of the source file during tokenization.
      */
     const char* current_ptr;
 
+    /**
+     * Points just past the last character of the source.
+     */
+    const char* source_end;
+
+    /**
+     * Whether or not read_expression has read any expressions yet.
+     */
+    bool has_read_expression = false;
+
     /**
      * Tracks the locations of initial tokens of expression sequences.
      */
     std::vector<std::vector<size_t>> expression_sequence_stack;
 
+    /**
+     * Returns the character at the given offset from the current position, or 0 if that's past the
+     * end of the source.
+     */
+    char peek(const size_t offset = 0) const {
+        return offset < static_cast<size_t>(source_end - current_ptr) ? current_ptr[offset] : 0;
+    }
+
     /**
      * Adds given token of given size to token vector. Useful for tokens of fixed value.
      */
@@ -170,6 +291,12 @@ struct tokenizer {
      */
     void add_string_token();
 
+    /**
+     * Adds the token starting at the current position, along with any expression sequence changes
+     * it makes.
+     */
+    void add_next_token();
+
     /**
      * Pops an expression sequence, marking the token that starts the final expression.
      */
@@ -185,6 +312,11 @@ struct tokenizer {
      * well.
      */
     void push_expression_sequence();
+
+    /**
+     * Advances past any whitespace and comments.
+     */
+    void skip_whitespace_and_comments();
 };
 
 /**
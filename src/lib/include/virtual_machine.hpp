@@ -1,28 +1,32 @@
 #pragma once
 
+#include <optional>
+#include <span>
 #include <string>
 #include <string_view>
 #include <unordered_map>
+#include <unordered_set>
 
 #include "bytecode.hpp"
+#include "gc_heap.hpp"
 
-void builtin_car(void* vm_void_ptr, uint8_t argc);
-void builtin_cdr(void* vm_void_ptr, uint8_t argc);
-void builtin_cons(void* vm_void_ptr, uint8_t argc);
-void builtin_display(void* vm_void_ptr, uint8_t argc);
-void builtin_divide(void* vm_void_ptr, uint8_t argc);
-void builtin_equal_numeric(void* vm_void_ptr, uint8_t argc);
-void builtin_eqv(void* vm_void_ptr, uint8_t argc);
-void builtin_greater(void* vm_void_ptr, uint8_t argc);
-void builtin_greater_equal(void* vm_void_ptr, uint8_t argc);
-void builtin_less(void* vm_void_ptr, uint8_t argc);
-void builtin_less_equal(void* vm_void_ptr, uint8_t argc);
-void builtin_minus(void* vm_void_ptr, uint8_t argc);
-void builtin_multiply(void* vm_void_ptr, uint8_t argc);
-void builtin_newline(void* vm_void_ptr, uint8_t argc);
-void builtin_null(void* vm_void_ptr, uint8_t argc);
-void builtin_odd(void* vm_void_ptr, uint8_t argc);
-void builtin_plus(void* vm_void_ptr, uint8_t argc);
+void builtin_car(void* vm_void_ptr, uint32_t argc);
+void builtin_cdr(void* vm_void_ptr, uint32_t argc);
+void builtin_cons(void* vm_void_ptr, uint32_t argc);
+void builtin_display(void* vm_void_ptr, uint32_t argc);
+void builtin_divide(void* vm_void_ptr, uint32_t argc);
+void builtin_equal_numeric(void* vm_void_ptr, uint32_t argc);
+void builtin_eqv(void* vm_void_ptr, uint32_t argc);
+void builtin_greater(void* vm_void_ptr, uint32_t argc);
+void builtin_greater_equal(void* vm_void_ptr, uint32_t argc);
+void builtin_less(void* vm_void_ptr, uint32_t argc);
+void builtin_less_equal(void* vm_void_ptr, uint32_t argc);
+void builtin_minus(void* vm_void_ptr, uint32_t argc);
+void builtin_multiply(void* vm_void_ptr, uint32_t argc);
+void builtin_newline(void* vm_void_ptr, uint32_t argc);
+void builtin_null(void* vm_void_ptr, uint32_t argc);
+void builtin_odd(void* vm_void_ptr, uint32_t argc);
+void builtin_plus(void* vm_void_ptr, uint32_t argc);
 
 inline const std::unordered_map<std::string_view, builtin_procedure> bp_name_to_ptr{
     {"cons", builtin_cons},
@@ -44,6 +48,61 @@ inline const std::unordered_map<std::string_view, builtin_procedure> bp_name_to_
     {"+", builtin_plus},
 };
 
+/**
+ * Names of the builtin procedures whose result depends only on their args and that have no side
+ * effects. Since builtin names can't be shadowed, calls to these with constant args can be evaluated
+ * at compile time (see evaluate_builtin_call).
+ */
+inline const std::unordered_set<std::string_view> pure_bp_names{
+    "/",
+    "=",
+    "eqv?",
+    ">",
+    ">=",
+    "<",
+    "<=",
+    "-",
+    "*",
+    "null?",
+    "odd?",
+    "+",
+};
+
+/**
+ * Describes a dedicated opcode that implements a builtin procedure without a call frame.
+ */
+struct builtin_opcode {
+
+    /**
+     * The dedicated opcode.
+     */
+    opcode op;
+
+    /**
+     * The argc the opcode handles. Calls to the builtin with any other argc are compiled as regular
+     * procedure calls.
+     */
+    uint8_t argc;
+};
+
+/**
+ * Maps the names of builtin procedures that have dedicated opcodes to those opcodes.
+ */
+inline const std::unordered_map<std::string_view, builtin_opcode> bp_name_to_opcode{
+    {"car", {opcode::car, 1}},
+    {"cdr", {opcode::cdr, 1}},
+    {"cons", {opcode::cons, 2}},
+    {"=", {opcode::equal_numeric, 2}},
+    {">", {opcode::greater, 2}},
+    {">=", {opcode::greater_equal, 2}},
+    {"<", {opcode::less, 2}},
+    {"<=", {opcode::less_equal, 2}},
+    {"-", {opcode::minus, 2}},
+    {"*", {opcode::multiply, 2}},
+    {"null?", {opcode::null, 1}},
+    {"+", {opcode::plus, 2}},
+};
+
 inline auto& get_bp_ptr_to_name() {
     static std::unordered_map<builtin_procedure, std::string_view> bp_ptr_to_name;
     static bool initialized = false;
@@ -58,6 +117,20 @@ inline auto& get_bp_ptr_to_name() {
     return bp_ptr_to_name;
 }
 
+/**
+ * Bytecode array of call/ec, which is also available under its long name.
+ */
+inline const std::vector<uint8_t> call_ec_code{
+    static_cast<uint8_t>(opcode::expect_argc), 1,
+    static_cast<uint8_t>(opcode::push_escape_continuation),
+    static_cast<uint8_t>(opcode::add_stack_var),
+    static_cast<uint8_t>(opcode::push_frame_index),
+    static_cast<uint8_t>(opcode::push_stack_var), 0,
+    static_cast<uint8_t>(opcode::push_stack_var), 1,
+    static_cast<uint8_t>(opcode::call),
+    static_cast<uint8_t>(opcode::ret),
+};
+
 /**
  * Maps the names of hand-rolled procedures to their bytecode arrays.
  */
@@ -68,7 +141,33 @@ inline const std::unordered_map<std::string_view, std::vector<uint8_t>> hrp_name
             static_cast<uint8_t>(opcode::expect_argc), 1,
             static_cast<uint8_t>(opcode::push_continuation),
             static_cast<uint8_t>(opcode::add_stack_var),
-            static_cast<uint8_t>(opcode::set_coarity_one),
+            static_cast<uint8_t>(opcode::push_frame_index),
+            static_cast<uint8_t>(opcode::push_stack_var), 0,
+            static_cast<uint8_t>(opcode::push_stack_var), 1,
+            static_cast<uint8_t>(opcode::call),
+            static_cast<uint8_t>(opcode::ret),
+        },
+    },
+    {"call/ec", call_ec_code},
+    {"call-with-escape-continuation", call_ec_code},
+    {
+        "reset",
+        {
+            static_cast<uint8_t>(opcode::expect_argc), 1,
+            static_cast<uint8_t>(opcode::push_prompt),
+            static_cast<uint8_t>(opcode::add_stack_var),
+            static_cast<uint8_t>(opcode::push_frame_index),
+            static_cast<uint8_t>(opcode::push_stack_var), 0,
+            static_cast<uint8_t>(opcode::call),
+            static_cast<uint8_t>(opcode::ret),
+        },
+    },
+    {
+        "shift",
+        {
+            static_cast<uint8_t>(opcode::expect_argc), 1,
+            static_cast<uint8_t>(opcode::shift),
+            static_cast<uint8_t>(opcode::add_stack_var),
             static_cast<uint8_t>(opcode::push_frame_index),
             static_cast<uint8_t>(opcode::push_stack_var), 0,
             static_cast<uint8_t>(opcode::push_stack_var), 1,
@@ -83,15 +182,37 @@ struct virtual_machine {
     std::vector<stack_value> stack;
 
     /**
-     * Current coarity state, which tells the vm how to handle return values and pushes to the value
-     * stack.
+     * The continuation of the bottom call frame in call_frame_stack. Capturing a continuation
+     * freezes the stacks into a stack segment, after which the stacks above only hold the executing
+     * call frame and whatever has been pushed since. Returning from the bottom call frame copies the
+     * next executing call frame back out of this continuation (see thaw_frozen_stack).
+     */
+    continuation frozen_stack{};
+
+    /**
+     * The executing program's constants as runtime values, made once when execution starts (see
+     * load_constants). push_constant copies from here, so every push of a lambda without captures
+     * or a hand-rolled procedure pushes the same lambda instead of allocating a new one.
+     */
+    std::vector<stack_value> constants;
+
+    /**
+     * Owns all heap objects created by this vm. The value stack, call frame stack and constants are
+     * the roots of every collection.
      */
-    coarity_type coarity_state;
+    gc_heap heap;
 
     /**
-     * Removes all values belonging in the call frame from the value stack.
+     * Allocates a new garbage-collected T, collecting first if one is due. Since a collection can
+     * happen here, anything that must survive it has to be reachable from the stacks.
      */
-    void clear_call_frame();
+    template <typename T, typename... Args>
+    gc_ptr<T> allocate(Args&&... args) {
+        if (heap.should_collect())
+            heap.collect(stack, call_frame_stack, frozen_stack, constants);
+
+        return heap.make<T>(std::forward<Args>(args)...);
+    }
 
     void execute(const bytecode& p);
     void execute_cons(size_t dest_from_top);
@@ -116,22 +237,128 @@ struct virtual_machine {
     const uint8_t* begin_instruction_ptr;
     const uint8_t* instruction_ptr;
 
+    /**
+     * Index in the call frame stack of the currently executing lambda's call frame. Maintained on
+     * every call and return so that variable access never has to search the call frame stack.
+     */
+    size_t executing_call_frame_index;
+
+    /**
+     * Value stack index of the executing lambda's first stack var (i.e. one past its frame index).
+     */
+    size_t stack_vars_begin;
+
+    /**
+     * Advances to the one byte arg of the current opcode and returns it.
+     */
+    uint8_t read_arg() {
+        return *++instruction_ptr;
+    }
+
+    /**
+     * Calls the given builtin procedure on the top argc stack values, which have no call frame yet.
+     * Used as the slow path of the dedicated builtin opcodes.
+     */
+    void execute_builtin_fallback(builtin_procedure bp, uint32_t argc);
+
+    /**
+     * Replaces the top two stack values with the result of Op if both are fixnums, otherwise calls
+     * the fallback builtin.
+     */
+    template <template <typename> typename Op>
+    void execute_fixnum_op(builtin_procedure fallback);
+
     void execute_call();
-    void execute_capture_stack_var();
-    void execute_capture_shared_var();
+    void execute_car();
+    void execute_cdr();
     void execute_cons();
-    void execute_expect_argc();
+    void execute_expect_argc(const size_t argc);
+
+    /**
+     * Rebinds the executing lambda's args and jumps back to the start of its body. See
+     * opcode::jump_backward.
+     */
+    void execute_jump_backward();
+
+    void execute_null();
+
+    /**
+     * Calls the given escape continuation with the args on the stack above the current call frame.
+     */
+    void execute_escape(const escape_continuation_ptr ec);
+
+    /**
+     * Calls the given delimited continuation with the args on the stack above the current call
+     * frame by pushing its call frames on top of the current one.
+     */
+    void execute_composable_continuation(const continuation_ptr c);
 
     /**
      * Pushes the current continuation to the value stack.
      */
     void execute_push_continuation();
 
-    void execute_push_stack_var();
-    void execute_push_shared_var();
+    void execute_push_escape_continuation();
+
+    /**
+     * Executes a make_closure opcode whose args, each of type Arg, start at the given pointer.
+     */
+    template <typename Arg>
+    void execute_make_closure(const bytecode& program, const uint8_t* const args);
+
+    void execute_push_constant(const size_t constant_index);
+
+    void execute_push_stack_var(const size_t stack_var_id);
+    void execute_push_shared_var(const size_t shared_var_index);
     void execute_ret();
-    void execute_set_stack_var();
-    void execute_set_shared_var();
+    void execute_set_stack_var(const size_t stack_var_id);
+    void execute_set_shared_var(const size_t shared_var_index);
+
+    /**
+     * Captures the delimited continuation of the executing shift call and aborts to its reset call.
+     * See opcode::shift.
+     */
+    void execute_shift();
+
+    void execute_tail_call();
+
+    /**
+     * Executes the opcode following a wide prefix with its four byte arg.
+     */
+    void execute_wide(const bytecode& program);
+
     call_frame& get_executing_call_frame();
     lambda_ptr& get_executing_lambda();
+
+    /**
+     * Makes the runtime values of the given program's constants. Lambda constants (which are only
+     * pushed for lambdas without captures) and hand-rolled procedures become lambdas with no
+     * captures, which are safe to share since lambdas are never modified after they're made.
+     */
+    void load_constants(const bytecode& program);
+
+    /**
+     * Makes the call frame at the given call frame stack index the executing one.
+     */
+    void set_executing_call_frame(const size_t call_frame_index);
+
+    /**
+     * Copies the executing call frame of frozen_stack (along with the pending call frames and
+     * values above it) to the bottom of the stacks, and makes it the executing call frame. The
+     * frozen segment itself is left untouched, and frozen_stack shrinks to the part below the copied
+     * call frame.
+     */
+    void thaw_frozen_stack();
 };
+
+/**
+ * Calls the given builtin procedure with the given constant args on the stack of the given scratch
+ * vm, whose stacks are cleared first, and returns the result as a constant. Returns nothing if the
+ * call throws, or if its result can't be represented as a constant (e.g. a bignum), so that the call
+ * is left to fail or allocate at runtime.
+ */
+std::optional<scheme_constant> evaluate_builtin_call(
+    virtual_machine& vm,
+    const builtin_procedure bp,
+    const std::span<const scheme_constant> args
+);
@@ -0,0 +1,98 @@
+#include <format>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "mapped_file.hpp"
+
+#ifdef _WIN32
+
+mapped_file::mapped_file(const char* const file_path) {
+    const HANDLE file_handle = CreateFileA(
+        file_path,
+        GENERIC_READ,
+        FILE_SHARE_READ,
+        nullptr,
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL,
+        nullptr
+    );
+    if (file_handle == INVALID_HANDLE_VALUE)
+        throw std::runtime_error(std::format("couldn't open file: {}", file_path));
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file_handle, &file_size)) {
+        CloseHandle(file_handle);
+        throw std::runtime_error(std::format("couldn't get size of file: {}", file_path));
+    }
+
+    size = static_cast<size_t>(file_size.QuadPart);
+    if (size == 0) {
+        CloseHandle(file_handle);
+        return;
+    }
+
+    // NOTE: the mapping object keeps the file open, so the file handle isn't needed after this.
+    mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file_handle);
+    if (!mapping_handle)
+        throw std::runtime_error(std::format("couldn't map file: {}", file_path));
+
+    data = static_cast<const uint8_t*>(MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0));
+    if (!data) {
+        CloseHandle(mapping_handle);
+        throw std::runtime_error(std::format("couldn't map file: {}", file_path));
+    }
+}
+
+mapped_file::~mapped_file() {
+    if (data)
+        UnmapViewOfFile(data);
+
+    if (mapping_handle)
+        CloseHandle(mapping_handle);
+}
+
+#else
+
+mapped_file::mapped_file(const char* const file_path) {
+    const int fd = open(file_path, O_RDONLY);
+    if (fd == -1)
+        throw std::runtime_error(std::format("couldn't open file: {}", file_path));
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == -1) {
+        close(fd);
+        throw std::runtime_error(std::format("couldn't get size of file: {}", file_path));
+    }
+
+    size = static_cast<size_t>(file_stat.st_size);
+    if (size == 0) {
+        close(fd);
+        return;
+    }
+
+    // NOTE: the mapping keeps its own reference to the file, so the fd isn't needed after this.
+    void* const mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        throw std::runtime_error(std::format("couldn't map file: {}", file_path));
+
+    data = static_cast<const uint8_t*>(mapping);
+}
+
+mapped_file::~mapped_file() {
+    if (data)
+        munmap(const_cast<uint8_t*>(data), size);
+}
+
+#endif
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <format>
 #include <string>
 #include <variant>
 
@@ -30,7 +31,7 @@ struct stack_value_overload : Ts... {
     using Ts::operator()...;
 
     auto operator()(const scheme_value_ptr& a) const {
-        return std::visit(
+        return visit(
             [this](const auto& a) {
                 return (*this)(a);
             },
@@ -39,7 +40,7 @@ struct stack_value_overload : Ts... {
     }
 
     auto operator()(const scheme_value_ptr& a, const auto& b) const {
-        return std::visit(
+        return visit(
             [this, &b](const auto& a) {
                 return (*this)(a, b);
             },
@@ -48,7 +49,7 @@ struct stack_value_overload : Ts... {
     }
 
     auto operator()(const auto& a, const scheme_value_ptr& b) const {
-        return std::visit(
+        return visit(
             [this, &a](const auto& b) {
                 return (*this)(a, b);
             },
@@ -57,7 +58,7 @@ struct stack_value_overload : Ts... {
     }
 
     auto operator()(const scheme_value_ptr& a, const scheme_value_ptr& b) const {
-        return std::visit(
+        return visit(
             [this](const auto& a, const auto& b) {
                 return (*this)(a, b);
             },
@@ -80,7 +81,11 @@ struct stack_value_formatter_overload {
     }
 
     std::string operator()(const symbol& v) const {
-        return std::format("{}", v);
+        return std::format("{}", v.name());
+    }
+
+    std::string operator()(const bignum_ptr& v) const {
+        return v->to_string();
     }
 
     std::string operator()(const builtin_procedure& v) const {
@@ -88,7 +93,11 @@ struct stack_value_formatter_overload {
     }
 
     std::string operator()(const continuation_ptr& v) const {
-        return std::format("cont: {}", reinterpret_cast<const void*>(v->frozen_call_frame_stack.back().return_ptr));
+        return std::format("cont: {}", reinterpret_cast<const void*>(v->segment->call_frames[v->executing_call_frame_index].return_ptr));
+    }
+
+    std::string operator()(const escape_continuation_ptr& v) const {
+        return std::format("escape cont: {}", reinterpret_cast<const void*>(v.get()));
     }
 
     std::string operator()(const lambda_ptr& v) const {
@@ -104,17 +113,17 @@ struct stack_value_formatter_overload {
         // NOTE: pairs consist of two scheme_values, not stack_values, but because all valid
         // scheme_value types are also valid stack_value types, the recursive call within the
         // visitor works fine.
-        const std::string car_str = std::visit(
+        const std::string car_str = visit(
             [this](const auto& a) {
                 return (*this)(a);
             },
             a->car
         );
 
-        if (const auto* const cdr_empty_list = std::get_if<empty_list>(&(a->cdr)))
+        if (const auto cdr_empty_list = get_if<empty_list>(&(a->cdr)))
             return std::format("{}", car_str);
 
-        if (const auto* const cdr_pair_ptr_ptr = std::get_if<pair_ptr>(&(a->cdr))) {
+        if (const auto cdr_pair_ptr_ptr = get_if<pair_ptr>(&(a->cdr))) {
             const auto cdr_str = pair_contents_to_string(*cdr_pair_ptr_ptr);
             return std::format("{} {}", car_str, cdr_str);
         }
@@ -122,7 +131,7 @@ struct stack_value_formatter_overload {
         return std::format(
             "{} . {}",
             car_str,
-            std::visit(
+            visit(
                 [this](const auto& a) {
                     return (*this)(a);
                 },
@@ -140,7 +149,7 @@ struct stack_value_formatter_overload {
         if constexpr (ShowSchemeValuePtr) {
             return std::format(
                 "ptr: {}",
-                std::visit(
+                visit(
                     [this](const auto& a) {
                         return (*this)(a);
                     },
@@ -148,7 +157,7 @@ struct stack_value_formatter_overload {
                 )
             );
         } else {
-            return std::visit(
+            return visit(
                 [this](const auto& a) {
                     return (*this)(a);
                 },
@@ -0,0 +1,26 @@
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+
+#include "scheme_value.hpp"
+
+symbol symbol::intern(const std::string_view name) {
+    // NOTE: the table is never shrunk, so an interned name stays at the same address for the
+    // lifetime of the process. Each name is stored right after its length (see
+    // symbol::from_interned_name), and the table's keys view the stored names.
+    static std::unordered_map<std::string_view, std::unique_ptr<char[]>> symbol_table;
+
+    auto it = symbol_table.find(name);
+    if (it == symbol_table.end()) {
+        const size_t size = name.size();
+        auto stored_name = std::make_unique<char[]>(sizeof(size) + size);
+        std::memcpy(stored_name.get(), &size, sizeof(size));
+        std::memcpy(stored_name.get() + sizeof(size), name.data(), size);
+
+        const std::string_view interned_name{stored_name.get() + sizeof(size), size};
+        it = symbol_table.emplace(interned_name, std::move(stored_name)).first;
+    }
+
+    return symbol{it->first};
+}
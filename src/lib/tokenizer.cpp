@@ -1,12 +1,142 @@
+#include <array>
+#include <bit>
 #include <format>
+#include <limits>
 #include <stdexcept>
+#include <stdint.h>
 #include <string>
 #include <vector>
 
 #include "tokenizer.hpp"
 
-static bool is_whitespace(const char c) {
-    return c == ' ' or c == '\n' or c == '\r';
+// Runs of whitespace, comments, identifiers, numbers and strings are scanned 32 (AVX2) or 16 (SSE2)
+// characters at a time where available. SSE2 is always available on x86-64, while AVX2 has to be
+// enabled for the whole build (e.g. with -march=native or /arch:AVX2).
+#if defined(PLOY_SIMD) and defined(__AVX2__)
+#define TOKENIZER_AVX2
+#define TOKENIZER_SIMD
+#include <immintrin.h>
+#elif defined(PLOY_SIMD) and (defined(__SSE2__) or defined(_M_X64) or (defined(_M_IX86_FP) and _M_IX86_FP >= 2))
+#define TOKENIZER_SSE2
+#define TOKENIZER_SIMD
+#include <emmintrin.h>
+#endif
+
+// The following character classification primitives have scalar versions, which operate on one
+// character and return a bool, and vector versions, which operate on a char_vector of characters
+// and return a char_vector with all bits set in each matching character's byte. This lets each
+// character class below be written once for both.
+
+static constexpr bool equal(const char c, const char other) {
+    return c == other;
+}
+
+/**
+ * Signed comparison, to match the vector version. Only meant for comparing against ascii.
+ */
+static constexpr bool greater(const char c, const char other) {
+    return static_cast<signed char>(c) > other;
+}
+
+static constexpr bool either(const bool a, const bool b) {
+    return a or b;
+}
+
+static constexpr bool both(const bool a, const bool b) {
+    return a and b;
+}
+
+static constexpr bool negate(const bool v) {
+    return !v;
+}
+
+#ifdef TOKENIZER_AVX2
+using char_vector = __m256i;
+
+static char_vector load(const char* const ptr) {
+    return _mm256_loadu_si256(reinterpret_cast<const char_vector*>(ptr));
+}
+
+static char_vector splat(const char c) {
+    return _mm256_set1_epi8(c);
+}
+
+static char_vector equal(const char_vector v, const char c) {
+    return _mm256_cmpeq_epi8(v, splat(c));
+}
+
+static char_vector greater(const char_vector v, const char c) {
+    return _mm256_cmpgt_epi8(v, splat(c));
+}
+
+static char_vector either(const char_vector a, const char_vector b) {
+    return _mm256_or_si256(a, b);
+}
+
+static char_vector both(const char_vector a, const char_vector b) {
+    return _mm256_and_si256(a, b);
+}
+
+static char_vector negate(const char_vector v) {
+    return _mm256_xor_si256(v, splat(-1));
+}
+
+/**
+ * Returns a bit mask with a bit set for each matching character, lowest bit first.
+ */
+static uint32_t to_mask(const char_vector v) {
+    return static_cast<uint32_t>(_mm256_movemask_epi8(v));
+}
+#elif defined(TOKENIZER_SSE2)
+using char_vector = __m128i;
+
+static char_vector load(const char* const ptr) {
+    return _mm_loadu_si128(reinterpret_cast<const char_vector*>(ptr));
+}
+
+static char_vector splat(const char c) {
+    return _mm_set1_epi8(c);
+}
+
+static char_vector equal(const char_vector v, const char c) {
+    return _mm_cmpeq_epi8(v, splat(c));
+}
+
+static char_vector greater(const char_vector v, const char c) {
+    return _mm_cmpgt_epi8(v, splat(c));
+}
+
+static char_vector either(const char_vector a, const char_vector b) {
+    return _mm_or_si128(a, b);
+}
+
+static char_vector both(const char_vector a, const char_vector b) {
+    return _mm_and_si128(a, b);
+}
+
+static char_vector negate(const char_vector v) {
+    return _mm_xor_si128(v, splat(-1));
+}
+
+/**
+ * Returns a bit mask with a bit set for each matching character, lowest bit first.
+ */
+static uint32_t to_mask(const char_vector v) {
+    return static_cast<uint32_t>(_mm_movemask_epi8(v));
+}
+#endif
+
+/**
+ * Matches characters from first to last inclusive. Both must be ascii.
+ */
+template <typename T>
+static constexpr auto in_range(const T c, const char first, const char last) {
+    return both(greater(c, first - 1), negate(greater(c, last)));
+}
+
+template <typename T>
+static constexpr auto is_whitespace(const T c) {
+    return either(equal(c, ' '), either(equal(c, '\n'), equal(c, '\r')));
 }
 
 /**
@@ -26,21 +156,22 @@ static bool is_eof(const char c) {
     return c == 0;
 }
 
-static bool is_digit(const char c) {
+static constexpr bool is_digit(const char c) {
     return c >= '0' and c <= '9';
 }
 
 /**
  * A numeric character is either 0-9 or `.`.
  */
-static bool is_numeric(const char c) {
-    return is_digit(c) or c == '.';
+template <typename T>
+static constexpr auto is_numeric(const T c) {
+    return either(in_range(c, '0', '9'), equal(c, '.'));
 }
 
 /**
  * Checks if character is a special initial character of an identifier.
  */
-static bool is_special_initial(const char c) {
+static constexpr bool is_special_initial(const char c) {
     switch (c) {
         case '!':
         case '$':
@@ -65,7 +196,7 @@ static bool is_special_initial(const char c) {
 /**
  * Checks if character is the initial character of an identifier.
  */
-static bool is_identifier_initial(const char c) {
+static constexpr bool is_identifier_initial(const char c) {
     return (
         (c >= 'A' and c <= 'Z')
         or (c >= 'a' and c <= 'z')
@@ -75,28 +206,104 @@ static bool is_identifier_initial(const char c) {
 
 /**
  * Checks if character is a subsequent character of an identifier (i.e. any position but the
- * initial).
+ * initial). That's any identifier initial, digit, +, -, . or @, which works out to all printable
+ * ascii except for the characters below. Matching those takes far fewer vector operations than
+ * matching the allowed characters.
  */
-static bool is_identifier_subsequent(const char c) {
-    return (
-        is_identifier_initial(c)
-        or is_digit(c)
-        or c == '+'
-        or c == '-'
-        or c == '.'
-        or c == '@'
+template <typename T>
+static constexpr auto is_identifier_subsequent(const T c) {
+    const auto excluded = either(
+        either(in_range(c, '"', '#'), in_range(c, '\'', ')')),
+        either(
+            either(equal(c, ','), equal(c, ';')),
+            either(either(in_range(c, '[', ']'), equal(c, '`')), in_range(c, '{', '}'))
+        )
     );
+
+    return both(in_range(c, '!', '~'), negate(excluded));
+}
+
+static_assert([] {
+    for (int i = -128; i < 128; i++) {
+        const char c = static_cast<char>(i);
+        const bool expected = is_identifier_initial(c) or is_digit(c) or c == '+' or c == '-' or c == '.' or c == '@';
+        if (is_identifier_subsequent(c) != expected)
+            return false;
+    }
+
+    return true;
+}());
+
+/**
+ * Lookup table of the characters that the given character class matches, for scanning one
+ * character at a time.
+ */
+template <auto CharClass>
+static constexpr auto char_class_table = [] {
+    std::array<bool, 256> table{};
+    for (size_t i = 0; i < table.size(); i++)
+        table[i] = CharClass(static_cast<char>(i));
+
+    return table;
+}();
+
+/**
+ * Returns a pointer to the first character from ptr up to end that the given character class
+ * doesn't match, or end if there isn't one.
+ */
+template <auto CharClass>
+static const char* skip_class(const char* ptr, const char* const end) {
+#ifdef TOKENIZER_SIMD
+    while (static_cast<size_t>(end - ptr) >= sizeof(char_vector)) {
+        const uint32_t mask = to_mask(negate(CharClass(load(ptr))));
+        if (mask)
+            return ptr + std::countr_zero(mask);
+
+        ptr += sizeof(char_vector);
+    }
+#endif
+
+    while (ptr != end and char_class_table<CharClass>[static_cast<uint8_t>(*ptr)])
+        ptr++;
+
+    return ptr;
 }
 
+// Character classes for skip_class.
+
+static constexpr auto whitespace_class = [](const auto c) {
+    return is_whitespace(c);
+};
+
+static constexpr auto numeric_class = [](const auto c) {
+    return is_numeric(c);
+};
+
+static constexpr auto identifier_subsequent_class = [](const auto c) {
+    return is_identifier_subsequent(c);
+};
+
+/**
+ * Anything but the end of a comment.
+ */
+static constexpr auto comment_class = [](const auto c) {
+    return negate(either(either(equal(c, '\n'), equal(c, '\r')), equal(c, 0)));
+};
+
+/**
+ * Anything but the end of a string.
+ */
+static constexpr auto string_class = [](const auto c) {
+    return negate(either(equal(c, '"'), equal(c, 0)));
+};
+
 void tokenizer::add_token(size_t size, token_type type) {
-    tokens.emplace_back(current_ptr, size, type);
+    tokens.add(current_ptr, current_ptr + size, type);
     current_ptr += size;
 }
 
 void tokenizer::add_hash_token() {
-    const char* next_ptr = current_ptr + 1;
-
-    switch (*next_ptr) {
+    switch (peek(1)) {
         case 't':
             add_token(2, token_type::boolean_true);
             break;
@@ -106,7 +313,7 @@ void tokenizer::add_hash_token() {
         case '\\':
             current_ptr += 2;
 
-            if (is_eof(*current_ptr))
+            if (is_eof(peek()))
                 throw std::runtime_error("unexpected eof");
 
             // TODO: expand this to include space and newline.
@@ -120,11 +327,11 @@ void tokenizer::add_hash_token() {
 }
 
 void tokenizer::add_minus_or_plus_token() {
-    const char* const next_ptr = current_ptr + 1;
+    const char next_char = peek(1);
 
-    if (is_numeric(*next_ptr))
+    if (is_numeric(next_char))
         add_number_token();
-    else if (is_delimiter(*next_ptr))
+    else if (is_delimiter(next_char))
         add_token(1, token_type::identifier);
     else
         throw std::runtime_error("invalid character after - or +");
@@ -134,13 +341,12 @@ void tokenizer::add_identifier_token() {
     const char* token_start = current_ptr;
     current_ptr++;
 
-    while (is_identifier_subsequent(*current_ptr))
-        current_ptr++;
+    current_ptr = skip_class<identifier_subsequent_class>(current_ptr, source_end);
 
-    if (is_eof(*current_ptr))
+    if (is_eof(peek()))
         throw std::runtime_error("unexpected eof after identifier");
 
-    tokens.emplace_back(token_start, current_ptr, token_type::identifier);
+    tokens.add(token_start, current_ptr, token_type::identifier);
 }
 
 void tokenizer::add_number_token() {
@@ -149,13 +355,12 @@ void tokenizer::add_number_token() {
         token_start++;
     current_ptr++;
 
-    while (is_numeric(*current_ptr))
-        current_ptr++;
+    current_ptr = skip_class<numeric_class>(current_ptr, source_end);
 
-    if (is_eof(*current_ptr))
+    if (is_eof(peek()))
         throw std::runtime_error("unexpected eof after number");
 
-    tokens.emplace_back(token_start, current_ptr, token_type::number);
+    tokens.add(token_start, current_ptr, token_type::number);
 }
 
 void tokenizer::add_string_token() {
@@ -163,18 +368,17 @@ void tokenizer::add_string_token() {
     const char* const token_start = current_ptr;
 
     // TODO: handle escaped quotes.
-    while (*current_ptr != 0 && *current_ptr != '"')
-        current_ptr++;
+    current_ptr = skip_class<string_class>(current_ptr, source_end);
 
-    if (is_eof(*current_ptr))
+    if (is_eof(peek()))
         throw std::runtime_error("source ended with no closing quote");
 
-    tokens.emplace_back(token_start, current_ptr, token_type::string);
+    tokens.add(token_start, current_ptr, token_type::string);
     current_ptr++;
 }
 
 void tokenizer::push_expression() {
-    if (tokens.size() > 1 and tokens[tokens.size() - 2].type == token_type::single_quote)
+    if (tokens.size() > 1 and tokens.type(tokens.size() - 2) == token_type::single_quote)
         return;
 
     expression_sequence_stack.back().emplace_back(tokens.size() - 1);
@@ -193,80 +397,112 @@ void tokenizer::pop_expression_sequence() {
     if (expression_sequence.empty())
         throw std::runtime_error("no expressions in expression sequence");
 
-    tokens[expression_sequence.back()].is_final = true;
+    tokens.set_final(expression_sequence.back());
     expression_sequence_stack.pop_back();
 }
 
-tokenizer::tokenizer(const char* const source) {
-    current_ptr = source;
+void tokenizer::skip_whitespace_and_comments() {
+    while (current_ptr != source_end) {
+        if (is_whitespace(*current_ptr)) {
+            current_ptr = skip_class<whitespace_class>(current_ptr + 1, source_end);
+        } else if (*current_ptr == ';') {
+            current_ptr = skip_class<comment_class>(current_ptr + 1, source_end);
+        } else {
+            return;
+        }
+    }
+}
+
+void tokenizer::add_next_token() {
+    const char current_char = *current_ptr;
+
+    switch (current_char) {
+        case '(':
+            add_token(1, token_type::left_paren);
+            push_expression_sequence();
+            break;
+        case ')':
+            // the top-level expression sequence is never popped
+            if (expression_sequence_stack.size() == 1)
+                throw std::runtime_error("unexpected )");
+
+            add_token(1, token_type::right_paren);
+            pop_expression_sequence();
+            break;
+        case '\'':
+            add_token(1, token_type::single_quote);
+            push_expression();
+            break;
+        case '.':
+            add_token(1, token_type::dot);
+            break;
+        case '#':
+            add_hash_token();
+            push_expression();
+            break;
+        case '"':
+            add_string_token();
+            push_expression();
+            break;
+        case '-':
+        case '+':
+            add_minus_or_plus_token();
+            push_expression();
+            break;
+        default:
+            if (is_numeric(current_char))
+                add_number_token();
+            else if (is_identifier_initial(current_char))
+                add_identifier_token();
+            else
+                throw std::runtime_error("unexpected first character of token");
+            push_expression();
+    }
+}
+
+tokenizer::tokenizer(const std::string_view source)
+    : current_ptr{source.data()}, source_end{source.data() + source.size()} {
+    if (source.size() > std::numeric_limits<uint32_t>::max())
+        throw std::runtime_error("source is too large");
+
+    tokens.source = source.data();
+}
+
+bool tokenizer::read_expression() {
+    tokens.clear();
+    expression_sequence_stack.clear();
     expression_sequence_stack.emplace_back();
 
-    while (*current_ptr != 0) {
-        const char current_char = *current_ptr;
+    skip_whitespace_and_comments();
 
-        if (is_whitespace(current_char)) {
-            current_ptr++;
-            continue;
-        }
+    if (current_ptr == source_end) {
+        if (!has_read_expression)
+            throw std::runtime_error("no expressions in expression sequence");
 
-        switch (current_char) {
-            case '(':
-                add_token(1, token_type::left_paren);
-                push_expression_sequence();
-                break;
-            case ')':
-                add_token(1, token_type::right_paren);
-                pop_expression_sequence();
-                break;
-            case '\'':
-                add_token(1, token_type::single_quote);
-                push_expression();
-                break;
-            case '.':
-                add_token(1, token_type::dot);
-                break;
-            case '#':
-                add_hash_token();
-                push_expression();
-                break;
-            case '"':
-                add_string_token();
-                push_expression();
-                break;
-            case '-':
-            case '+':
-                add_minus_or_plus_token();
-                push_expression();
-                break;
-            case ';':
-                current_ptr++;
-                while (*current_ptr != '\n' and *current_ptr != '\r' and *current_ptr != 0)
-                    current_ptr++;
-                break;
-            default:
-                if (is_numeric(current_char))
-                    add_number_token();
-                else if (is_identifier_initial(current_char))
-                    add_identifier_token();
-                else
-                    throw std::runtime_error("unexpected first character of token");
-                push_expression();
-        }
+        tokens.add(current_ptr, current_ptr, token_type::eof);
+        return false;
     }
 
-    if (expression_sequence_stack.size() != 1)
-        throw std::runtime_error("unexpected expression stack size");
+    // NOTE: the expression is done once we're back in the top-level expression sequence, unless the
+    // last token was a quote, which still needs its datum.
+    do {
+        if (current_ptr == source_end)
+            throw std::runtime_error("unexpected eof in expression");
 
-    pop_expression_sequence();
+        add_next_token();
+        skip_whitespace_and_comments();
+    } while (expression_sequence_stack.size() != 1 or tokens.type(tokens.size() - 1) == token_type::single_quote);
 
-    tokens.emplace_back(current_ptr, current_ptr, token_type::eof);
+    has_read_expression = true;
+    tokens.add(current_ptr, current_ptr, token_type::eof);
+    return true;
 }
 
 std::string tokenizer::to_string() const {
     std::string str = "tokens: [";
 
-    for (const auto& t : tokens)
-        str += std::format("{{\"{}\", {}}}, ", t.value, static_cast<int>(t.type));
+    for (size_t i = 0; i < tokens.size(); i++)
+        str += std::format("{{\"{}\", {}}}, ", tokens.value(i), static_cast<int>(tokens.type(i)));
 
     str += "]";
     return str;
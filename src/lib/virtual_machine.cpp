@@ -1,25 +1,17 @@
+#include <algorithm>
+#include <concepts>
 #include <format>
+#include <iterator>
 #include <functional>
-#include <memory>
+#include <optional>
 #include <print>
+#include <span>
 #include <stdexcept>
 #include <variant>
 
 #include "overload.hpp"
 #include "virtual_machine.hpp"
 
-static constexpr overload scheme_constant_to_stack_value_visitor{
-    [](const hand_rolled_procedure_constant& v) -> stack_value {
-        return stack_value{std::make_shared<lambda>(std::vector<scheme_value_ptr>{}, v.bytecode_offset)};
-    },
-    [](const lambda_constant& v) -> stack_value {
-        return stack_value{std::make_shared<lambda>(std::vector<scheme_value_ptr>{}, v.bytecode_offset)};
-    },
-    [](const auto& v) -> stack_value {
-        return stack_value{v};
-    },
-};
-
 static constexpr overload scheme_value_to_stack_value_visitor{
     [](const auto& v) -> stack_value {
         return stack_value{v};
@@ -35,15 +27,6 @@ static constexpr overload stack_value_to_scheme_value_visitor{
     },
 };
 
-static constexpr overload stack_value_to_scheme_value_ptr_visitor{
-    [](const scheme_value_ptr& v) -> scheme_value_ptr {
-        return v;
-    },
-    [](const auto& v) -> scheme_value_ptr {
-        return std::make_shared<scheme_value>(v);
-    },
-};
-
 static constexpr stack_value_overload boolean_eval_visitor{
     [](const bool& a) -> bool {
         return a;
@@ -54,48 +37,128 @@ static constexpr stack_value_overload boolean_eval_visitor{
     },
 };
 
+/**
+ * Returns the escape continuation of the given call frame if it's a call/ec call frame (i.e. it's
+ * executing call/ec and holds an escape continuation as its second stack var), or an empty pointer
+ * otherwise. The given values are the ones that the call frame's frame index points into.
+ */
+static escape_continuation_ptr get_call_ec_continuation(
+    const call_frame& frame,
+    const std::span<const stack_value> values
+) {
+    const size_t i = frame.frame_index + 2;
+    if (!frame.executing_lambda or i >= values.size())
+        return {};
+
+    const auto ec = get_if<escape_continuation_ptr>(&values[i]);
+    if (!ec or (*ec)->bytecode_offset != frame.executing_lambda->bytecode_offset)
+        return {};
+
+    return *ec;
+}
+
+template <typename T>
+concept exact_integer = std::same_as<T, int64_t> or std::same_as<T, bignum_ptr>;
+
+template <typename T>
+concept number = exact_integer<T> or std::same_as<T, double>;
+
+static bignum to_bignum(const int64_t v) {
+    return bignum{v};
+}
+
+static const bignum& to_bignum(const bignum_ptr& v) {
+    return *v;
+}
+
+static double to_double(const int64_t v) {
+    return static_cast<double>(v);
+}
+
+static double to_double(const double v) {
+    return v;
+}
+
+static double to_double(const bignum_ptr& v) {
+    return v->to_double();
+}
+
+/**
+ * Checks if the given integer can be stored as a fixnum.
+ */
+static constexpr bool fits_fixnum([[maybe_unused]] const int64_t v) {
+#ifdef PLOY_NAN_BOXING
+    return nan_boxed_value::fits_fixnum(v);
+#else
+    return true;
+#endif
+}
+
+/**
+ * Applies the arithmetic Op to the given fixnums. Returns false if the result doesn't fit in a
+ * fixnum, in which case the operation has to be redone with bignums.
+ */
+template <template <typename> typename Op>
+static bool checked_fixnum_op(const int64_t a, const int64_t b, int64_t& result) {
+    bool overflow;
+    if constexpr (std::is_same_v<Op<int64_t>, std::plus<int64_t>>) {
+        overflow = add_overflow(a, b, result);
+    } else if constexpr (std::is_same_v<Op<int64_t>, std::minus<int64_t>>) {
+        overflow = sub_overflow(a, b, result);
+    } else if constexpr (std::is_same_v<Op<int64_t>, std::multiplies<int64_t>>) {
+        overflow = mul_overflow(a, b, result);
+    } else {
+        static_assert(std::is_same_v<Op<int64_t>, std::divides<int64_t>>);
+
+        if (b == 0)
+            throw std::runtime_error("division by zero");
+
+        overflow = a == std::numeric_limits<int64_t>::min() and b == -1;
+        if (!overflow)
+            result = a / b;
+    }
+
+    return !overflow and fits_fixnum(result);
+}
+
+/**
+ * Returns the given exact integer as a fixnum if it fits in one, otherwise as a new bignum.
+ */
+static stack_value make_integer(virtual_machine* vm, bignum&& v) {
+    if (const auto i = v.to_int64(); i and fits_fixnum(*i))
+        return *i;
+
+    return vm->allocate<bignum>(std::move(v));
+}
+
 template <template <typename> typename Op, uint8_t Identity, bool AllowNoArgs>
-static void native_fold_left(void* vm_void_ptr, uint8_t argc) {
+static void native_fold_left(void* vm_void_ptr, uint32_t argc) {
     virtual_machine* vm = static_cast<virtual_machine*>(vm_void_ptr);
 
-    constexpr stack_value_overload unary_visitor{
-        [](const int64_t& a) -> stack_value {
-            return stack_value{Op<int64_t>()(Identity, a)};
-        },
-        [](const double& a) -> stack_value {
-            return stack_value{Op<double>()(Identity, a)};
-        },
-        [](const auto&) -> stack_value {
-            throw std::runtime_error("unexpected type for unary op");
-        },
-    };
+    const stack_value_overload binary_visitor{
+        [vm](const int64_t& a, const int64_t& b) -> stack_value {
+            int64_t result;
+            if (checked_fixnum_op<Op>(a, b, result))
+                return result;
 
-    constexpr stack_value_overload binary_visitor{
-        [](const int64_t& a, const int64_t& b) -> stack_value {
-            return stack_value{Op<int64_t>()(a, b)};
+            return make_integer(vm, Op<bignum>()(bignum{a}, bignum{b}));
         },
-        [](const int64_t& a, const double& b) -> stack_value {
-            return stack_value{Op<double>()(static_cast<double>(a), b)};
+        [vm]<exact_integer A, exact_integer B>(const A& a, const B& b) -> stack_value {
+            return make_integer(vm, Op<bignum>()(to_bignum(a), to_bignum(b)));
         },
-        [](const double& a, const int64_t& b) -> stack_value {
-            return stack_value{Op<double>()(a, static_cast<double>(b))};
-        },
-        [](const double& a, const double& b) -> stack_value {
-            return stack_value{Op<double>()(a, b)};
+        []<number A, number B>(const A& a, const B& b) -> stack_value {
+            return stack_value{Op<double>()(to_double(a), to_double(b))};
         },
         [](const auto&, const auto&) -> stack_value {
             throw std::runtime_error("unexpected type for binary op");
         },
     };
 
-    if constexpr (AllowNoArgs) {
-        // if vm coarity state is any, clear call frame and return immediately since this procedure
-        // produces no side effects.
-        if (vm->coarity_state == coarity_type::any) {
-            vm->clear_call_frame();
-            return;
-        }
+    const auto unary_visitor = [&binary_visitor](const auto& a) -> stack_value {
+        return binary_visitor(int64_t{Identity}, a);
+    };
 
+    if constexpr (AllowNoArgs) {
         if (argc == 0) {
             vm->stack[vm->stack.size() - 1] = int64_t{Identity};
             return;
@@ -105,46 +168,37 @@ static void native_fold_left(void* vm_void_ptr, uint8_t argc) {
             throw std::runtime_error("need at least one arg for this procedure");
     }
 
-    // if vm coarity state is any, clear call frame and return immediately since this procedure
-    // produces no side effects.
-    if (vm->coarity_state == coarity_type::any) {
-        vm->clear_call_frame();
-        return;
-    }
-
     size_t last_i = vm->stack.size() - 1;
 
     if (argc == 1) {
-        vm->stack[last_i - 1] = std::visit(unary_visitor, vm->stack[last_i]);
+        vm->stack[last_i - 1] = visit(unary_visitor, vm->stack[last_i]);
     } else {
         size_t first_i = last_i + 1 - argc;
 
-        stack_value result = vm->stack[first_i];
+        // NOTE: the running result is kept on the stack so that it stays reachable if the next
+        // operation allocates a bignum.
         for (size_t i = first_i + 1; i <= last_i; i++)
-            result = std::visit(binary_visitor, result, vm->stack[i]);
+            vm->stack[first_i] = visit(binary_visitor, vm->stack[first_i], vm->stack[i]);
 
-        vm->stack[first_i - 1] = result;
+        vm->stack[first_i - 1] = vm->stack[first_i];
     }
 
     vm->pop_excess(1);
 }
 
 template <template <typename> typename Op>
-static void native_monotonic_reduce(void* vm_void_ptr, uint8_t argc) {
+static void native_monotonic_reduce(void* vm_void_ptr, uint32_t argc) {
     virtual_machine* vm = static_cast<virtual_machine*>(vm_void_ptr);
 
     constexpr stack_value_overload binary_visitor{
         [](const int64_t& a, const int64_t& b) -> bool {
             return Op<int64_t>()(a, b);
         },
-        [](const int64_t& a, const double& b) -> bool {
-            return Op<double>()(static_cast<double>(a), b);
-        },
-        [](const double& a, const int64_t& b) -> bool {
-            return Op<double>()(a, static_cast<double>(b));
+        []<exact_integer A, exact_integer B>(const A& a, const B& b) -> bool {
+            return Op<bignum>()(to_bignum(a), to_bignum(b));
         },
-        [](const double& a, const double& b) -> bool {
-            return Op<double>()(a, b);
+        []<number A, number B>(const A& a, const B& b) -> bool {
+            return Op<double>()(to_double(a), to_double(b));
         },
         [](const auto&, const auto&) -> bool {
             throw std::runtime_error("unexpected type for binary op");
@@ -154,19 +208,12 @@ static void native_monotonic_reduce(void* vm_void_ptr, uint8_t argc) {
     if (argc < 2)
         throw std::runtime_error("need at least two args for this procedure");
 
-    // if vm coarity state is any, clear call frame and return immediately since this procedure
-    // produces no side effects.
-    if (vm->coarity_state == coarity_type::any) {
-        vm->clear_call_frame();
-        return;
-    }
-
     size_t last_i = vm->stack.size() - 1;
     size_t first_i = last_i + 1 - argc;
 
     bool reduction = true;
     for (size_t i = first_i; i < last_i; i++)
-        if (!std::visit(binary_visitor, vm->stack[i], vm->stack[i + 1])) {
+        if (!visit(binary_visitor, vm->stack[i], vm->stack[i + 1])) {
             reduction = false;
             break;
         }
@@ -176,24 +223,17 @@ static void native_monotonic_reduce(void* vm_void_ptr, uint8_t argc) {
     vm->pop_excess(1);
 }
 
-void builtin_car(void* vm_void_ptr, uint8_t argc) {
+void builtin_car(void* vm_void_ptr, uint32_t argc) {
     virtual_machine* vm = static_cast<virtual_machine*>(vm_void_ptr);
 
     if (argc != 1)
         throw std::runtime_error("procedure needs one arg");
 
-    // if vm coarity state is any, clear call frame and return immediately since this procedure
-    // produces no side effects.
-    if (vm->coarity_state == coarity_type::any) {
-        vm->clear_call_frame();
-        return;
-    }
-
     size_t pair_i = vm->stack.size() - 1;
     size_t dest_i = pair_i - 1;
-    vm->stack[dest_i] = std::visit(
+    vm->stack[dest_i] = visit(
         scheme_value_to_stack_value_visitor,
-        std::visit(
+        visit(
             stack_value_overload{
                 [](const pair_ptr& a) -> scheme_value {
                     return a->car;
@@ -209,24 +249,17 @@ void builtin_car(void* vm_void_ptr, uint8_t argc) {
     vm->pop_excess(1);
 }
 
-void builtin_cdr(void* vm_void_ptr, uint8_t argc) {
+void builtin_cdr(void* vm_void_ptr, uint32_t argc) {
     virtual_machine* vm = static_cast<virtual_machine*>(vm_void_ptr);
 
     if (argc != 1)
         throw std::runtime_error("procedure needs one arg");
 
-    // if vm coarity state is any, clear call frame and return immediately since this procedure
-    // produces no side effects.
-    if (vm->coarity_state == coarity_type::any) {
-        vm->clear_call_frame();
-        return;
-    }
-
     size_t pair_i = vm->stack.size() - 1;
     size_t dest_i = pair_i - 1;
-    vm->stack[dest_i] = std::visit(
+    vm->stack[dest_i] = visit(
         scheme_value_to_stack_value_visitor,
-        std::visit(
+        visit(
             stack_value_overload{
                 [](const pair_ptr& a) -> scheme_value {
                     return a->cdr;
@@ -242,60 +275,51 @@ void builtin_cdr(void* vm_void_ptr, uint8_t argc) {
     vm->pop_excess(1);
 }
 
-void builtin_cons(void* vm_void_ptr, uint8_t argc) {
+void builtin_cons(void* vm_void_ptr, uint32_t argc) {
     virtual_machine* vm = static_cast<virtual_machine*>(vm_void_ptr);
 
     if (argc != 2)
         throw std::runtime_error("procedure needs two args");
 
-    // if vm coarity state is any, clear call frame and return immediately since this procedure
-    // produces no side effects.
-    if (vm->coarity_state == coarity_type::any) {
-        vm->clear_call_frame();
-        return;
-    }
-
     vm->execute_cons(2);
     vm->pop_excess(1);
 }
 
-void builtin_display(void* vm_void_ptr, uint8_t argc) {
+void builtin_display(void* vm_void_ptr, uint32_t argc) {
     virtual_machine* vm = static_cast<virtual_machine*>(vm_void_ptr);
 
     // TODO: need to update this when ports are added
     if (argc != 1)
         throw std::runtime_error("procedure only takes one arg");
 
-    std::print("{}", std::visit(stack_value_formatter_overload<false>{}, vm->stack.back()));
+    std::print("{}", visit(stack_value_formatter_overload<false>{}, vm->stack.back()));
 
-    vm->clear_call_frame();
+    // the return value is unspecified
+    vm->stack[vm->stack.size() - 2] = empty_list{};
+    vm->pop_excess(1);
 }
 
-void builtin_divide(void* vm_void_ptr, uint8_t argc) {
+void builtin_divide(void* vm_void_ptr, uint32_t argc) {
     native_fold_left<std::divides, 1, false>(vm_void_ptr, argc);
 }
 
-void builtin_equal_numeric(void* vm_void_ptr, uint8_t argc) {
+void builtin_equal_numeric(void* vm_void_ptr, uint32_t argc) {
     native_monotonic_reduce<std::equal_to>(vm_void_ptr, argc);
 }
 
-void builtin_eqv(void* vm_void_ptr, uint8_t argc) {
+void builtin_eqv(void* vm_void_ptr, uint32_t argc) {
     virtual_machine* vm = static_cast<virtual_machine*>(vm_void_ptr);
 
     if (argc != 2)
         throw std::runtime_error("procedure needs two args");
 
-    // if vm coarity state is any, clear call frame and return immediately since this procedure
-    // produces no side effects.
-    if (vm->coarity_state == coarity_type::any) {
-        vm->clear_call_frame();
-        return;
-    }
-
     constexpr stack_value_overload eqv_visitor{
         []<typename T>(const T& a, const T& b) -> bool {
             return a == b;
         },
+        [](const bignum_ptr& a, const bignum_ptr& b) -> bool {
+            return *a == *b;
+        },
         []<typename T, typename U>(const T&, const U&) -> bool {
             return false;
         },
@@ -304,36 +328,36 @@ void builtin_eqv(void* vm_void_ptr, uint8_t argc) {
     size_t second_i = vm->stack.size() - 1;
     size_t first_i = second_i - 1;
 
-    vm->stack[first_i - 1] = std::visit(eqv_visitor, vm->stack[first_i], vm->stack[second_i]);
+    vm->stack[first_i - 1] = visit(eqv_visitor, vm->stack[first_i], vm->stack[second_i]);
 
     vm->pop_excess(1);
 }
 
-void builtin_greater(void* vm_void_ptr, uint8_t argc) {
+void builtin_greater(void* vm_void_ptr, uint32_t argc) {
     native_monotonic_reduce<std::greater>(vm_void_ptr, argc);
 }
 
-void builtin_greater_equal(void* vm_void_ptr, uint8_t argc) {
+void builtin_greater_equal(void* vm_void_ptr, uint32_t argc) {
     native_monotonic_reduce<std::greater_equal>(vm_void_ptr, argc);
 }
 
-void builtin_less(void* vm_void_ptr, uint8_t argc) {
+void builtin_less(void* vm_void_ptr, uint32_t argc) {
     native_monotonic_reduce<std::less>(vm_void_ptr, argc);
 }
 
-void builtin_less_equal(void* vm_void_ptr, uint8_t argc) {
+void builtin_less_equal(void* vm_void_ptr, uint32_t argc) {
     native_monotonic_reduce<std::less_equal>(vm_void_ptr, argc);
 }
 
-void builtin_minus(void* vm_void_ptr, uint8_t argc) {
+void builtin_minus(void* vm_void_ptr, uint32_t argc) {
     native_fold_left<std::minus, 0, false>(vm_void_ptr, argc);
 }
 
-void builtin_multiply(void* vm_void_ptr, uint8_t argc) {
+void builtin_multiply(void* vm_void_ptr, uint32_t argc) {
     native_fold_left<std::multiplies, 1, true>(vm_void_ptr, argc);
 }
 
-void builtin_newline(void* vm_void_ptr, uint8_t argc) {
+void builtin_newline(void* vm_void_ptr, uint32_t argc) {
     virtual_machine* vm = static_cast<virtual_machine*>(vm_void_ptr);
 
     // TODO: need to update this when ports are added
@@ -342,10 +366,11 @@ void builtin_newline(void* vm_void_ptr, uint8_t argc) {
 
     std::print("\n");
 
-    vm->clear_call_frame();
+    // the return value is unspecified
+    vm->stack.back() = empty_list{};
 }
 
-void builtin_null(void* vm_void_ptr, uint8_t argc) {
+void builtin_null(void* vm_void_ptr, uint32_t argc) {
     virtual_machine* vm = static_cast<virtual_machine*>(vm_void_ptr);
 
     constexpr stack_value_overload unary_visitor{
@@ -360,26 +385,22 @@ void builtin_null(void* vm_void_ptr, uint8_t argc) {
     if (argc != 1)
         throw std::runtime_error("procedure can only take one arg");
 
-    // if vm coarity state is any, clear call frame and return immediately since this procedure
-    // produces no side effects.
-    if (vm->coarity_state == coarity_type::any) {
-        vm->clear_call_frame();
-        return;
-    }
-
     size_t last_i = vm->stack.size() - 1;
 
-    vm->stack[last_i - 1] = std::visit(unary_visitor, vm->stack[last_i]);
+    vm->stack[last_i - 1] = visit(unary_visitor, vm->stack[last_i]);
     vm->pop_excess(1);
 }
 
-void builtin_odd(void* vm_void_ptr, uint8_t argc) {
+void builtin_odd(void* vm_void_ptr, uint32_t argc) {
     virtual_machine* vm = static_cast<virtual_machine*>(vm_void_ptr);
 
     constexpr stack_value_overload unary_visitor{
         [](const int64_t& a) -> stack_value {
             return stack_value{a % 2 != 0};
         },
+        [](const bignum_ptr& a) -> stack_value {
+            return stack_value{a->is_odd()};
+        },
         [](const auto&) -> stack_value {
             throw std::runtime_error("unexpected type for unary op");
         },
@@ -388,244 +409,478 @@ void builtin_odd(void* vm_void_ptr, uint8_t argc) {
     if (argc != 1)
         throw std::runtime_error("procedure can only take one arg");
 
-    // if vm coarity state is any, clear call frame and return immediately since this procedure
-    // produces no side effects.
-    if (vm->coarity_state == coarity_type::any) {
-        vm->clear_call_frame();
-        return;
-    }
-
     size_t last_i = vm->stack.size() - 1;
 
-    vm->stack[last_i - 1] = std::visit(unary_visitor, vm->stack[last_i]);
+    vm->stack[last_i - 1] = visit(unary_visitor, vm->stack[last_i]);
     vm->pop_excess(1);
 }
 
-void builtin_plus(void* vm_void_ptr, uint8_t argc) {
+void builtin_plus(void* vm_void_ptr, uint32_t argc) {
     native_fold_left<std::plus, 0, true>(vm_void_ptr, argc);
 }
 
-void virtual_machine::clear_call_frame() {
-    stack.erase(stack.begin() + call_frame_stack.back().frame_index, stack.end());
-}
+// Dispatch macros for the main vm loop. With computed gotos (labels-as-values, supported by GCC and
+// Clang), every handler ends with its own indirect jump to the next handler, which gives the branch
+// predictor one jump site per opcode instead of a single shared one. Otherwise we fall back to a
+// plain switch.
+//
+// VM_NEXT() advances past the current opcode's last byte and dispatches. VM_DISPATCH_NO_ADVANCE() is
+// for handlers that have already pointed instruction_ptr at the next opcode (i.e. jumps).
+#if defined(PLOY_COMPUTED_GOTO) and defined(__GNUC__)
+#define VM_COMPUTED_GOTO
+#define VM_DISPATCH_NO_ADVANCE() goto *dispatch_table[*instruction_ptr]
+#define VM_DISPATCH() VM_DISPATCH_NO_ADVANCE();
+#define VM_CASE(name) label_##name:
+#define VM_NEXT() \
+    do { \
+        instruction_ptr++; \
+        VM_DISPATCH_NO_ADVANCE(); \
+    } while (false)
+#else
+#define VM_DISPATCH_NO_ADVANCE() continue
+#define VM_DISPATCH() switch (*instruction_ptr)
+#define VM_CASE(name) case static_cast<uint8_t>(opcode::name):
+#define VM_NEXT() \
+    { \
+        instruction_ptr++; \
+        continue; \
+    }
+#endif
+
+#ifdef VM_COMPUTED_GOTO
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
 
 void virtual_machine::execute(const bytecode& program) {
+#ifdef VM_COMPUTED_GOTO
+    // NOTE: must be kept in the same order as the opcode enum.
+    static void* const dispatch_table[] = {
+        &&label_add_stack_var,
+        &&label_call,
+        &&label_car,
+        &&label_cdr,
+        &&label_cons,
+        &&label_equal_numeric,
+        &&label_expect_argc,
+        &&label_greater,
+        &&label_greater_equal,
+        &&label_halt,
+        &&label_jump_backward,
+        &&label_jump_forward,
+        &&label_jump_forward_if_not,
+        &&label_less,
+        &&label_less_equal,
+        &&label_make_closure,
+        &&label_minus,
+        &&label_multiply,
+        &&label_null,
+        &&label_plus,
+        &&label_pop,
+        &&label_push_constant,
+        &&label_push_continuation,
+        &&label_push_escape_continuation,
+        &&label_push_frame_index,
+        &&label_push_prompt,
+        &&label_push_shared_var,
+        &&label_push_stack_var,
+        &&label_ret,
+        &&label_set_shared_var,
+        &&label_set_stack_var,
+        &&label_shift,
+        &&label_tail_call,
+        &&label_wide,
+    };
+    static_assert(std::size(dispatch_table) == opcode_infos.size());
+#endif
+
     begin_instruction_ptr = program.code.data();
     instruction_ptr = begin_instruction_ptr;
+    executing_call_frame_index = 0;
+    stack_vars_begin = 0;
+    frozen_stack = continuation{};
+    load_constants(program);
 
     while (true) {
-        switch (*instruction_ptr) {
-            case static_cast<uint8_t>(opcode::push_constant):
-                instruction_ptr++;
-
-                if (coarity_state == coarity_type::any)
-                    break;
-
-                stack.emplace_back(std::visit(
-                    scheme_constant_to_stack_value_visitor,
-                    program.get_constant(*instruction_ptr)
-                ));
-                break;
-            case static_cast<uint8_t>(opcode::cons):
-                if (coarity_state == coarity_type::any)
-                    break;
-
+        VM_DISPATCH() {
+            VM_CASE(push_constant)
+                execute_push_constant(read_arg());
+                VM_NEXT();
+            VM_CASE(cons)
                 execute_cons();
                 stack.pop_back();
-                break;
-            case static_cast<uint8_t>(opcode::push_shared_var):
-                if (coarity_state == coarity_type::any) {
-                    instruction_ptr++;
-                    break;
-                }
-
-                execute_push_shared_var();
-                break;
-            case static_cast<uint8_t>(opcode::push_stack_var):
-                if (coarity_state == coarity_type::any) {
-                    instruction_ptr++;
-                    break;
-                }
-
-                execute_push_stack_var();
-                break;
-            case static_cast<uint8_t>(opcode::set_shared_var):
-                execute_set_shared_var();
-                break;
-            case static_cast<uint8_t>(opcode::set_stack_var):
-                execute_set_stack_var();
-                break;
-            case static_cast<uint8_t>(opcode::add_stack_var):
+                VM_NEXT();
+            VM_CASE(car)
+                execute_car();
+                VM_NEXT();
+            VM_CASE(cdr)
+                execute_cdr();
+                VM_NEXT();
+            VM_CASE(null)
+                execute_null();
+                VM_NEXT();
+            VM_CASE(plus)
+                execute_fixnum_op<std::plus>(builtin_plus);
+                VM_NEXT();
+            VM_CASE(minus)
+                execute_fixnum_op<std::minus>(builtin_minus);
+                VM_NEXT();
+            VM_CASE(multiply)
+                execute_fixnum_op<std::multiplies>(builtin_multiply);
+                VM_NEXT();
+            VM_CASE(equal_numeric)
+                execute_fixnum_op<std::equal_to>(builtin_equal_numeric);
+                VM_NEXT();
+            VM_CASE(less)
+                execute_fixnum_op<std::less>(builtin_less);
+                VM_NEXT();
+            VM_CASE(less_equal)
+                execute_fixnum_op<std::less_equal>(builtin_less_equal);
+                VM_NEXT();
+            VM_CASE(greater)
+                execute_fixnum_op<std::greater>(builtin_greater);
+                VM_NEXT();
+            VM_CASE(greater_equal)
+                execute_fixnum_op<std::greater_equal>(builtin_greater_equal);
+                VM_NEXT();
+            VM_CASE(push_shared_var)
+                execute_push_shared_var(read_arg());
+                VM_NEXT();
+            VM_CASE(push_stack_var)
+                execute_push_stack_var(read_arg());
+                VM_NEXT();
+            VM_CASE(set_shared_var)
+                execute_set_shared_var(read_arg());
+                VM_NEXT();
+            VM_CASE(set_stack_var)
+                execute_set_stack_var(read_arg());
+                VM_NEXT();
+            VM_CASE(add_stack_var)
                 get_executing_call_frame().stack_var_count++;
-                break;
-            case static_cast<uint8_t>(opcode::set_coarity_any):
-                coarity_state = coarity_type::any;
-                break;
-            case static_cast<uint8_t>(opcode::set_coarity_one):
-                coarity_state = coarity_type::one;
-                break;
-            case static_cast<uint8_t>(opcode::capture_shared_var):
-                execute_capture_shared_var();
-                break;
-            case static_cast<uint8_t>(opcode::capture_stack_var):
-                execute_capture_stack_var();
-                break;
-            case static_cast<uint8_t>(opcode::push_frame_index):
+                VM_NEXT();
+            VM_CASE(pop)
+                stack.pop_back();
+                VM_NEXT();
+            VM_CASE(make_closure)
+                execute_make_closure<uint8_t>(program, instruction_ptr + 1);
+                VM_NEXT();
+            VM_CASE(push_frame_index)
                 call_frame_stack.emplace_back(lambda_ptr{}, stack.size(), nullptr);
-                break;
-            case static_cast<uint8_t>(opcode::call):
+                VM_NEXT();
+            VM_CASE(call)
                 execute_call();
-                break;
-            case static_cast<uint8_t>(opcode::expect_argc):
-                execute_expect_argc();
-                break;
-            case static_cast<uint8_t>(opcode::ret):
+                VM_NEXT();
+            VM_CASE(tail_call)
+                execute_tail_call();
+                VM_NEXT();
+            VM_CASE(expect_argc)
+                execute_expect_argc(read_arg());
+                VM_NEXT();
+            VM_CASE(ret)
                 execute_ret();
-                break;
-            case static_cast<uint8_t>(opcode::jump_forward_if_not):
+                VM_NEXT();
+            VM_CASE(jump_forward_if_not)
                 if (stack.empty())
                     throw std::runtime_error("stack empty for conditional jump");
 
                 instruction_ptr++;
 
-                if (!std::visit(boolean_eval_visitor, stack.back()))
+                if (!visit(boolean_eval_visitor, stack.back()))
                     instruction_ptr += bytecode::read_value<jump_size_type>(instruction_ptr);
                 else
                     instruction_ptr += sizeof(jump_size_type);
 
                 stack.pop_back();
 
-                continue;
-            case static_cast<uint8_t>(opcode::jump_forward):
+                VM_DISPATCH_NO_ADVANCE();
+            VM_CASE(jump_backward)
+                execute_jump_backward();
+                VM_DISPATCH_NO_ADVANCE();
+            VM_CASE(jump_forward)
                 instruction_ptr++;
                 instruction_ptr += bytecode::read_value<jump_size_type>(instruction_ptr);
-                continue;
-            case static_cast<uint8_t>(opcode::halt):
+                VM_DISPATCH_NO_ADVANCE();
+            VM_CASE(halt)
                 return;
-            case static_cast<uint8_t>(opcode::push_continuation):
+            VM_CASE(push_continuation)
                 execute_push_continuation();
-                break;
+                VM_NEXT();
+            VM_CASE(push_escape_continuation)
+                execute_push_escape_continuation();
+                VM_NEXT();
+            VM_CASE(wide)
+                execute_wide(program);
+                VM_NEXT();
+            VM_CASE(push_prompt)
+                stack.emplace_back(allocate<escape_continuation>(true));
+                VM_NEXT();
+            VM_CASE(shift)
+                execute_shift();
+                VM_NEXT();
         }
 
         instruction_ptr++;
     }
 }
 
-void virtual_machine::execute_capture_shared_var() {
-    instruction_ptr++;
-    size_t shared_var_index = *instruction_ptr;
+#ifdef VM_COMPUTED_GOTO
+#pragma GCC diagnostic pop
+#endif
 
-    auto executing_lambda = get_executing_lambda();
+void virtual_machine::execute_builtin_fallback(builtin_procedure bp, uint32_t argc) {
+    if (stack.size() < argc)
+        throw std::runtime_error("not enough stack elements for builtin");
 
-    if (shared_var_index >= executing_lambda->captures.size())
-        throw std::runtime_error("parent lambda capture index out of bounds for capture");
+    // Give the builtin the same stack layout and call frame it would've had from a regular call.
+    size_t frame_index = stack.size() - argc;
+    stack.emplace(stack.begin() + frame_index, bp);
+    call_frame_stack.emplace_back(lambda_ptr{}, frame_index, nullptr);
 
-    const auto& value = executing_lambda->captures[shared_var_index];
+    bp(this, argc);
 
-    // TODO: if capture is self-referential, make it a weak_ptr in the captures vector.
-    static const stack_value_overload lambda_visitor{
-        [&value](const lambda_ptr& l_ptr) -> void {
-            l_ptr->captures.emplace_back(value);
-        },
-        [](const auto&) -> void {
-            throw std::runtime_error("expected lambda on stack top for capture");
-        },
-    };
+    call_frame_stack.pop_back();
+}
 
-    std::visit(lambda_visitor, stack.back());
+template <template <typename> typename Op>
+void virtual_machine::execute_fixnum_op(builtin_procedure fallback) {
+    if (stack.size() < 2)
+        throw std::runtime_error("need two stack elements for binary op");
+
+    size_t b_i = stack.size() - 1;
+    size_t a_i = b_i - 1;
+
+    const auto a = get_if<int64_t>(&stack[a_i]);
+    const auto b = get_if<int64_t>(&stack[b_i]);
+    if (!a or !b) {
+        execute_builtin_fallback(fallback, 2);
+        return;
+    }
+
+    if constexpr (std::is_same_v<decltype(Op<int64_t>()(*a, *b)), bool>) {
+        stack[a_i] = Op<int64_t>()(*a, *b);
+    } else {
+        int64_t result;
+        if (!checked_fixnum_op<Op>(*a, *b, result)) {
+            execute_builtin_fallback(fallback, 2);
+            return;
+        }
+
+        stack[a_i] = result;
+    }
+
+    stack.pop_back();
 }
 
-void virtual_machine::execute_capture_stack_var() {
-    instruction_ptr++;
-    size_t stack_var_index = get_executing_call_frame().frame_index + 1 + (*instruction_ptr);
+void virtual_machine::execute_car() {
+    if (stack.empty())
+        throw std::runtime_error("stack empty for car");
 
-    if (stack_var_index >= stack.size())
-        throw std::runtime_error("stack empty for capture");
+    if (const auto p = get_if<pair_ptr>(&stack.back())) {
+        stack_value result = visit(scheme_value_to_stack_value_visitor, (*p)->car);
+        stack.back() = std::move(result);
+    } else {
+        execute_builtin_fallback(builtin_car, 1);
+    }
+}
 
-    const auto& value = std::visit(stack_value_to_scheme_value_ptr_visitor, stack[stack_var_index]);
-    stack[stack_var_index] = value;
+void virtual_machine::execute_cdr() {
+    if (stack.empty())
+        throw std::runtime_error("stack empty for cdr");
 
-    // TODO: if capture is self-referential, make it a weak_ptr in the captures vector.
-    static const stack_value_overload lambda_visitor{
-        [&value](const lambda_ptr& l_ptr) -> void {
-            l_ptr->captures.emplace_back(value);
-        },
-        [](const auto&) -> void {
-            throw std::runtime_error("expected lambda on stack top for capture");
-        },
-    };
+    if (const auto p = get_if<pair_ptr>(&stack.back())) {
+        stack_value result = visit(scheme_value_to_stack_value_visitor, (*p)->cdr);
+        stack.back() = std::move(result);
+    } else {
+        execute_builtin_fallback(builtin_cdr, 1);
+    }
+}
+
+void virtual_machine::execute_null() {
+    if (stack.empty())
+        throw std::runtime_error("stack empty for null?");
 
-    std::visit(lambda_visitor, stack.back());
+    stack.back() = static_cast<bool>(get_if<empty_list>(&stack.back()));
 }
 
-void virtual_machine::execute_expect_argc() {
+template <typename Arg>
+void virtual_machine::execute_make_closure(const bytecode& program, const uint8_t* const args) {
+    const uint32_t constant_index = bytecode::read_value<Arg>(args);
+    const uint32_t capture_count = bytecode::read_value<Arg>(args + sizeof(Arg));
+    const uint8_t* const descriptors = args + 2 * sizeof(Arg);
+
+    // leave instruction_ptr on the last byte of the descriptors, same as read_arg does for one byte
+    // args
+    instruction_ptr = descriptors + capture_count * sizeof(Arg) - 1;
+
+    const auto l_ptr = get_if<lambda_constant>(&program.get_constant(constant_index));
+    if (!l_ptr)
+        throw std::runtime_error("expected lambda constant for make_closure");
+
+    // NOTE: the closure is pushed before its captures are filled in so that it stays reachable if
+    // boxing a captured variable allocates, and so that it can capture itself.
+    const lambda_ptr closure = allocate<lambda>(std::vector<stack_value>(capture_count), l_ptr->bytecode_offset);
+    stack.emplace_back(closure);
+
+    for (uint32_t i = 0; i < capture_count; i++) {
+        const uint32_t descriptor = bytecode::read_value<Arg>(descriptors + i * sizeof(Arg));
+        const size_t var_index = descriptor >> capture_kind_bits;
+
+        switch (static_cast<capture_kind>(descriptor & ((1 << capture_kind_bits) - 1))) {
+            case capture_kind::self:
+                closure->captures[i] = closure;
+                break;
+            case capture_kind::shared_var: {
+                const auto& executing_lambda = get_executing_lambda();
+
+                if (var_index >= executing_lambda->captures.size())
+                    throw std::runtime_error("parent lambda capture index out of bounds for capture");
+
+                closure->captures[i] = executing_lambda->captures[var_index];
+                break;
+            }
+            case capture_kind::stack_value: {
+                const size_t stack_var_index = stack_vars_begin + var_index;
+
+                if (stack_var_index >= stack.size())
+                    throw std::runtime_error("stack empty for capture");
+
+                closure->captures[i] = stack[stack_var_index];
+                break;
+            }
+            case capture_kind::stack_var: {
+                const size_t stack_var_index = stack_vars_begin + var_index;
+
+                if (stack_var_index >= stack.size())
+                    throw std::runtime_error("stack empty for capture");
+
+                // box the stack var if it hasn't been captured already
+                if (!get_if<scheme_value_ptr>(&stack[stack_var_index]))
+                    stack[stack_var_index] = allocate<scheme_value>(
+                        visit(stack_value_to_scheme_value_visitor, stack[stack_var_index])
+                    );
+
+                closure->captures[i] = stack[stack_var_index];
+                break;
+            }
+            default:
+                throw std::runtime_error("invalid capture kind");
+        }
+    }
+}
+
+void virtual_machine::execute_jump_backward() {
+    call_frame& current_call_frame = get_executing_call_frame();
+
+    const size_t stack_vars_end = stack_vars_begin + current_call_frame.stack_var_count;
+    if (stack_vars_end > stack.size())
+        throw std::runtime_error("stack too small for jump_backward");
+
+    const size_t argc = stack.size() - stack_vars_end;
+
+    // move the new args down over the stack vars, which includes any that were defined in the body
+    std::move(stack.begin() + stack_vars_end, stack.end(), stack.begin() + stack_vars_begin);
+    stack.erase(stack.begin() + stack_vars_begin + argc, stack.end());
+
+    current_call_frame.stack_var_count = static_cast<uint32_t>(argc);
+
+    instruction_ptr++;
+    instruction_ptr -= bytecode::read_value<jump_size_type>(instruction_ptr);
+}
+
+void virtual_machine::execute_expect_argc(const size_t argc) {
     if (call_frame_stack.empty())
         throw std::runtime_error("call frame stack empty for expect_argc");
 
-    instruction_ptr++;
-    if (*instruction_ptr != call_frame_stack.back().stack_var_count)
+    if (argc != call_frame_stack.back().stack_var_count)
         throw std::runtime_error("expected argc does not match actual argc");
 }
 
 void virtual_machine::execute_push_continuation() {
-    stack.emplace_back(std::make_shared<continuation>(
-        call_frame_stack,
-        stack,
-        coarity_state
-    ));
+    // Moving the stacks into the segment is what makes capturing cheap: only the executing call
+    // frame is copied back out, no matter how deep the stacks are.
+    const auto segment = allocate<stack_segment>(
+        std::move(call_frame_stack),
+        std::move(stack),
+        frozen_stack
+    );
+
+    frozen_stack = continuation{
+        segment,
+        segment->call_frames.size(),
+        segment->values.size(),
+        executing_call_frame_index,
+    };
+
+    // NOTE: the continuation is made directly by the heap so that no collection can happen before
+    // the segment is reachable from the stacks again.
+    const continuation_ptr c = heap.make<continuation>(frozen_stack);
+
+    thaw_frozen_stack();
+    stack.emplace_back(c);
 }
 
-void virtual_machine::execute_push_shared_var() {
-    auto executing_lambda = get_executing_lambda();
+void virtual_machine::execute_push_escape_continuation() {
+    stack.emplace_back(allocate<escape_continuation>(false, get_executing_lambda()->bytecode_offset));
+}
+
+void virtual_machine::execute_push_constant(const size_t constant_index) {
+    if (constant_index >= constants.size())
+        throw std::runtime_error("constant index out of bounds");
+
+    stack.emplace_back(constants[constant_index]);
+}
+
+void virtual_machine::execute_push_shared_var(const size_t shared_var_index) {
+    const auto& executing_lambda = get_executing_lambda();
 
-    instruction_ptr++;
-    size_t shared_var_index = *instruction_ptr;
     if (shared_var_index >= executing_lambda->captures.size())
         throw std::runtime_error("lambda capture index out of bounds for push");
 
-    stack.emplace_back(std::visit(
-        scheme_value_to_stack_value_visitor,
-        *(executing_lambda->captures[shared_var_index])
-    ));
+    const stack_value& capture = executing_lambda->captures[shared_var_index];
+
+    if (const auto sc_ptr_ptr = get_if<scheme_value_ptr>(&capture))
+        stack.emplace_back(visit(scheme_value_to_stack_value_visitor, **sc_ptr_ptr));
+    else
+        stack.emplace_back(capture);
 }
 
-void virtual_machine::execute_push_stack_var() {
-    instruction_ptr++;
-    size_t stack_var_index = get_executing_call_frame().frame_index + 1 + (*instruction_ptr);
+void virtual_machine::execute_push_stack_var(const size_t stack_var_id) {
+    size_t stack_var_index = stack_vars_begin + stack_var_id;
 
     if (stack_var_index >= stack.size())
         throw std::runtime_error("stack empty for capture");
 
-    if (const auto* sc_ptr_ptr = std::get_if<scheme_value_ptr>(&stack[stack_var_index]))
-        stack.emplace_back(std::visit(scheme_value_to_stack_value_visitor, **sc_ptr_ptr));
+    if (const auto sc_ptr_ptr = get_if<scheme_value_ptr>(&stack[stack_var_index]))
+        stack.emplace_back(visit(scheme_value_to_stack_value_visitor, **sc_ptr_ptr));
     else
         stack.emplace_back(stack[stack_var_index]);
 }
 
-void virtual_machine::execute_set_shared_var() {
-    auto executing_lambda = get_executing_lambda();
+void virtual_machine::execute_set_shared_var(const size_t shared_var_index) {
+    const auto& executing_lambda = get_executing_lambda();
 
-    instruction_ptr++;
-    size_t shared_var_index = *instruction_ptr;
     if (shared_var_index >= executing_lambda->captures.size())
         throw std::runtime_error("lambda capture index out of bounds for set");
 
-    *(executing_lambda->captures[shared_var_index]) = std::visit(stack_value_to_scheme_value_visitor, stack.back());
+    const auto sc_ptr_ptr = get_if<scheme_value_ptr>(&executing_lambda->captures[shared_var_index]);
+    if (!sc_ptr_ptr)
+        throw std::runtime_error("can't set shared var that was captured by value");
+
+    **sc_ptr_ptr = visit(stack_value_to_scheme_value_visitor, stack.back());
 
     stack.pop_back();
 }
 
-void virtual_machine::execute_set_stack_var() {
-    instruction_ptr++;
-    size_t stack_var_index = get_executing_call_frame().frame_index + 1 + (*instruction_ptr);
+void virtual_machine::execute_set_stack_var(const size_t stack_var_id) {
+    size_t stack_var_index = stack_vars_begin + stack_var_id;
 
     if (stack_var_index >= stack.size())
         throw std::runtime_error("invalid stack index for set");
 
-    if (const auto* dest_sc_ptr_ptr = std::get_if<scheme_value_ptr>(&stack[stack_var_index]))
-        **dest_sc_ptr_ptr = std::visit(stack_value_to_scheme_value_visitor, stack.back());
-    else if (const auto* source_sc_ptr_ptr = std::get_if<scheme_value_ptr>(&stack.back()))
-        stack[stack_var_index] = std::visit(scheme_value_to_stack_value_visitor, **source_sc_ptr_ptr);
+    if (const auto dest_sc_ptr_ptr = get_if<scheme_value_ptr>(&stack[stack_var_index]))
+        **dest_sc_ptr_ptr = visit(stack_value_to_scheme_value_visitor, stack.back());
+    else if (const auto source_sc_ptr_ptr = get_if<scheme_value_ptr>(&stack.back()))
+        stack[stack_var_index] = visit(scheme_value_to_stack_value_visitor, **source_sc_ptr_ptr);
     else
         stack[stack_var_index] = stack.back();
 
@@ -642,37 +897,296 @@ void virtual_machine::execute_call() {
     call_frame& current_call_frame = call_frame_stack.back();
 
     size_t argc = stack.size() - 1 - current_call_frame.frame_index;
-    if (argc > std::numeric_limits<uint8_t>::max())
+    if (argc > std::numeric_limits<uint32_t>::max())
         throw std::runtime_error("exceeded max number of args allowed");
 
-    const auto& callable_variant = std::visit(stack_value_to_scheme_value_visitor, stack[current_call_frame.frame_index]);
-    if (const auto* bp_ptr = std::get_if<builtin_procedure>(&callable_variant)) {
-        (*bp_ptr)(this, static_cast<uint8_t>(argc));
+    const auto& callable_variant = visit(stack_value_to_scheme_value_visitor, stack[current_call_frame.frame_index]);
+    if (const auto bp_ptr = get_if<builtin_procedure>(&callable_variant)) {
+        (*bp_ptr)(this, static_cast<uint32_t>(argc));
 
         call_frame_stack.pop_back();
-    } else if (const auto* lambda_ptr_ptr = std::get_if<lambda_ptr>(&callable_variant)) {
+    } else if (const auto lambda_ptr_ptr = get_if<lambda_ptr>(&callable_variant)) {
         current_call_frame.executing_lambda = *lambda_ptr_ptr;
-        current_call_frame.stack_var_count = static_cast<uint8_t>(argc);
+        current_call_frame.stack_var_count = static_cast<uint32_t>(argc);
         current_call_frame.return_ptr = instruction_ptr;
-        current_call_frame.return_coarity_state = coarity_state;
+        current_call_frame.return_call_frame_index = executing_call_frame_index;
+        set_executing_call_frame(call_frame_stack.size() - 1);
         instruction_ptr = begin_instruction_ptr + (*lambda_ptr_ptr)->bytecode_offset - 1;
-    } else if (const auto* continuation_ptr_ptr = std::get_if<continuation_ptr>(&callable_variant)) {
+    } else if (const auto continuation_ptr_ptr = get_if<continuation_ptr>(&callable_variant)) {
+        if ((*continuation_ptr_ptr)->composable) {
+            execute_composable_continuation(*continuation_ptr_ptr);
+            return;
+        }
+
         // save args passed to continuation
         const std::vector<stack_value> cont_args{stack.cbegin() + current_call_frame.frame_index + 1, stack.cend()};
 
         // restore continuation state
-        call_frame_stack = (*continuation_ptr_ptr)->frozen_call_frame_stack;
-        stack = (*continuation_ptr_ptr)->frozen_value_stack;
-        coarity_state = (*continuation_ptr_ptr)->frozen_coarity_state;
+        frozen_stack = **continuation_ptr_ptr;
+        call_frame_stack.clear();
+        stack.clear();
+        thaw_frozen_stack();
 
         // append continuation args to stack and execute a lambda return
         stack.insert(stack.end(), cont_args.cbegin(), cont_args.cend());
         execute_ret();
+    } else if (const auto escape_continuation_ptr_ptr = get_if<escape_continuation_ptr>(&callable_variant)) {
+        execute_escape(*escape_continuation_ptr_ptr);
     } else {
         throw std::runtime_error("expected callable at frame index");
     }
 }
 
+void virtual_machine::execute_escape(const escape_continuation_ptr ec) {
+    if (stack.size() - call_frame_stack.back().frame_index != 2)
+        throw std::runtime_error("escape continuation expects one arg");
+
+    const stack_value result = stack.back();
+
+    // Delimited continuations can put copies of the call/ec call frame anywhere on the stacks, so
+    // the target is the nearest call/ec call frame of this escape continuation.
+    const auto find_target = [&ec](
+        const std::span<const call_frame> frames,
+        const std::span<const stack_value> values
+    ) -> std::optional<size_t> {
+        for (size_t i = frames.size(); i-- > 0;)
+            if (get_call_ec_continuation(frames[i], values) == ec)
+                return i;
+
+        return std::nullopt;
+    };
+
+    if (const auto i = find_target(call_frame_stack, stack)) {
+        // the common case: the call/ec call frame is still on the stacks, so they just get
+        // truncated
+        const call_frame& target = call_frame_stack[*i];
+        stack.erase(stack.begin() + target.frame_index + 1 + target.stack_var_count, stack.end());
+        call_frame_stack.erase(call_frame_stack.begin() + *i + 1, call_frame_stack.end());
+    } else {
+        // the call/ec call frame has been frozen by a continuation capture since it was called, so
+        // continue from a view of its segment that ends at that call frame.
+        continuation c = frozen_stack;
+        std::optional<size_t> frozen_i;
+        for (; c.segment; c = c.segment->parent) {
+            frozen_i = find_target(
+                std::span{c.segment->call_frames}.first(c.call_frame_count),
+                std::span{c.segment->values}.first(c.value_count)
+            );
+
+            if (frozen_i)
+                break;
+        }
+
+        if (!frozen_i)
+            throw std::runtime_error("escape continuation called after its extent");
+
+        const call_frame& target = c.segment->call_frames[*frozen_i];
+        frozen_stack = continuation{c.segment, *frozen_i + 1, target.frame_index + 1 + target.stack_var_count, *frozen_i};
+        call_frame_stack.clear();
+        stack.clear();
+        thaw_frozen_stack();
+    }
+
+    stack.emplace_back(result);
+    execute_ret();
+}
+
+void virtual_machine::execute_composable_continuation(const continuation_ptr c) {
+    const size_t frame_base = call_frame_stack.size() - 1;
+    const size_t value_base = call_frame_stack.back().frame_index;
+
+    if (stack.size() - value_base != 2)
+        throw std::runtime_error("delimited continuation expects one arg");
+
+    const stack_value result = stack.back();
+
+    // replace the continuation's call frame with the captured ones, which start at the reset call
+    call_frame_stack.pop_back();
+    stack.erase(stack.begin() + value_base, stack.end());
+
+    const auto& segment = *c->segment;
+    call_frame_stack.insert(
+        call_frame_stack.end(),
+        segment.call_frames.cbegin(),
+        segment.call_frames.cbegin() + c->call_frame_count
+    );
+    stack.insert(stack.end(), segment.values.cbegin(), segment.values.cbegin() + c->value_count);
+
+    for (size_t i = frame_base; i < call_frame_stack.size(); i++) {
+        call_frame_stack[i].frame_index += value_base;
+        call_frame_stack[i].return_call_frame_index += frame_base;
+    }
+
+    // the reset call returns to where the continuation was called
+    call_frame& reset_call_frame = call_frame_stack[frame_base];
+    reset_call_frame.return_ptr = instruction_ptr;
+    reset_call_frame.return_call_frame_index = executing_call_frame_index;
+
+    // the top call frame is the shift call, which returns the arg passed to the continuation
+    stack.emplace_back(result);
+    execute_ret();
+}
+
+void virtual_machine::execute_shift() {
+    // A reset call frame is one that holds a prompt as its second stack var.
+    const auto is_prompt = [this](const call_frame& frame) {
+        if (!frame.executing_lambda or frame.stack_var_count < 2)
+            return false;
+
+        const auto ec = get_if<escape_continuation_ptr>(&stack[frame.frame_index + 2]);
+        return ec and (*ec)->is_prompt;
+    };
+
+    // find the nearest reset call frame, thawing frozen call frames until it's on the stacks
+    size_t prompt_index = call_frame_stack.size() - 1;
+    while (!is_prompt(call_frame_stack[prompt_index])) {
+        if (prompt_index > 0) {
+            prompt_index--;
+            continue;
+        }
+
+        if (!frozen_stack.segment)
+            throw std::runtime_error("shift called outside of reset");
+
+        std::vector<call_frame> live_call_frames = std::move(call_frame_stack);
+        std::vector<stack_value> live_values = std::move(stack);
+        call_frame_stack.clear();
+        stack.clear();
+        thaw_frozen_stack();
+
+        const size_t frame_base = call_frame_stack.size();
+        const size_t value_base = stack.size();
+        for (auto& frame : live_call_frames) {
+            frame.frame_index += value_base;
+            frame.return_call_frame_index += frame_base;
+        }
+
+        // the bottom live call frame returns into the call frame that was just thawed
+        live_call_frames.front().return_call_frame_index = 0;
+
+        call_frame_stack.insert(call_frame_stack.end(), live_call_frames.cbegin(), live_call_frames.cend());
+        stack.insert(stack.end(), live_values.cbegin(), live_values.cend());
+        prompt_index = frame_base - 1;
+    }
+
+    const call_frame prompt_call_frame = call_frame_stack[prompt_index];
+    const call_frame thunk_call_frame = call_frame_stack[prompt_index + 1];
+    const call_frame shift_call_frame = call_frame_stack.back();
+    const stack_value shift_callable = stack[shift_call_frame.frame_index];
+    const stack_value f = stack[shift_call_frame.frame_index + 1];
+
+    // copy everything from the reset call frame up into a segment of its own
+    std::vector<call_frame> captured_call_frames{call_frame_stack.cbegin() + prompt_index, call_frame_stack.cend()};
+    for (auto& frame : captured_call_frames) {
+        frame.frame_index -= prompt_call_frame.frame_index;
+        frame.return_call_frame_index -= prompt_index;
+    }
+
+    const auto segment = allocate<stack_segment>(
+        std::move(captured_call_frames),
+        std::vector<stack_value>{stack.cbegin() + prompt_call_frame.frame_index, stack.cend()},
+        continuation{}
+    );
+
+    // NOTE: the continuation is made directly by the heap so that no collection can happen before
+    // it's on the stack.
+    const continuation_ptr k = heap.make<continuation>(
+        segment,
+        segment->call_frames.size(),
+        segment->values.size(),
+        segment->call_frames.size() - 1,
+        true
+    );
+
+    // abort to the reset call by making the shift call take the place of the call to reset's thunk
+    call_frame_stack.erase(call_frame_stack.begin() + prompt_index + 1, call_frame_stack.end());
+    stack.erase(stack.begin() + thunk_call_frame.frame_index, stack.end());
+
+    call_frame_stack.emplace_back(
+        shift_call_frame.executing_lambda,
+        thunk_call_frame.frame_index,
+        thunk_call_frame.return_ptr,
+        shift_call_frame.stack_var_count,
+        thunk_call_frame.return_call_frame_index
+    );
+    stack.emplace_back(shift_callable);
+    stack.emplace_back(f);
+    set_executing_call_frame(call_frame_stack.size() - 1);
+
+    stack.emplace_back(k);
+}
+
+void virtual_machine::execute_wide(const bytecode& program) {
+    const auto op = static_cast<opcode>(instruction_ptr[1]);
+
+    if (op == opcode::make_closure) {
+        execute_make_closure<wide_arg_type>(program, instruction_ptr + 2);
+        return;
+    }
+    const wide_arg_type arg = bytecode::read_value<wide_arg_type>(instruction_ptr + 2);
+
+    // leave instruction_ptr on the last byte of the arg, same as read_arg does for one byte args
+    instruction_ptr += sizeof(opcode_wide) - 1;
+
+    switch (op) {
+        case opcode::expect_argc:
+            execute_expect_argc(arg);
+            break;
+        case opcode::push_constant:
+            execute_push_constant(arg);
+            break;
+        case opcode::push_shared_var:
+            execute_push_shared_var(arg);
+            break;
+        case opcode::push_stack_var:
+            execute_push_stack_var(arg);
+            break;
+        case opcode::set_shared_var:
+            execute_set_shared_var(arg);
+            break;
+        case opcode::set_stack_var:
+            execute_set_stack_var(arg);
+            break;
+        default:
+            throw std::runtime_error("opcode has no wide form");
+    }
+}
+
+void virtual_machine::execute_tail_call() {
+    if (stack.empty())
+        throw std::runtime_error("stack empty for procedure call");
+
+    if (call_frame_stack.size() <= executing_call_frame_index + 1)
+        throw std::runtime_error("call frame stack too small for tail call");
+
+    const call_frame& new_call_frame = call_frame_stack.back();
+    call_frame& current_call_frame = get_executing_call_frame();
+
+    // only lambdas reuse the current call frame, everything else is a regular call.
+    const auto& callable_variant = visit(stack_value_to_scheme_value_visitor, stack[new_call_frame.frame_index]);
+    const auto lambda_ptr_ptr = get_if<lambda_ptr>(&callable_variant);
+    if (!lambda_ptr_ptr) {
+        execute_call();
+        return;
+    }
+
+    size_t argc = stack.size() - 1 - new_call_frame.frame_index;
+    if (argc > std::numeric_limits<uint32_t>::max())
+        throw std::runtime_error("exceeded max number of args allowed");
+
+    // move the callable and its args down over the executing call frame, which is reused for the
+    // call. Nothing between the two call frames can still be pending since this is a tail call.
+    const size_t shift = new_call_frame.frame_index - current_call_frame.frame_index;
+    std::move(stack.begin() + new_call_frame.frame_index, stack.end(), stack.begin() + current_call_frame.frame_index);
+    stack.erase(stack.end() - shift, stack.end());
+
+    current_call_frame.executing_lambda = *lambda_ptr_ptr;
+    current_call_frame.stack_var_count = static_cast<uint32_t>(argc);
+    instruction_ptr = begin_instruction_ptr + (*lambda_ptr_ptr)->bytecode_offset - 1;
+
+    call_frame_stack.erase(call_frame_stack.begin() + executing_call_frame_index + 1, call_frame_stack.end());
+}
+
 void virtual_machine::execute_cons() {
     execute_cons(1);
 }
@@ -684,9 +1198,9 @@ void virtual_machine::execute_cons(size_t dest_from_top) {
     size_t cdr_i = stack.size() - 1;
     size_t car_i = cdr_i - 1;
 
-    stack[cdr_i - dest_from_top] = std::make_shared<pair>(
-        std::visit(stack_value_to_scheme_value_visitor, stack[car_i]),
-        std::visit(stack_value_to_scheme_value_visitor, stack[cdr_i])
+    stack[cdr_i - dest_from_top] = allocate<pair>(
+        visit(stack_value_to_scheme_value_visitor, stack[car_i]),
+        visit(stack_value_to_scheme_value_visitor, stack[cdr_i])
     );
 
     // NOTE: callers must pop the stack as needed
@@ -697,31 +1211,101 @@ void virtual_machine::execute_ret() {
         throw std::runtime_error("call frame stack empty for ret");
 
     const auto& current_call_frame = call_frame_stack.back();
-    coarity_state = current_call_frame.return_coarity_state;
 
-    if (coarity_state == coarity_type::one) {
-        size_t frame_start = current_call_frame.frame_index;
-        size_t return_value_start = frame_start + 1 + current_call_frame.stack_var_count;
+    size_t frame_start = current_call_frame.frame_index;
+    size_t return_value_start = frame_start + 1 + current_call_frame.stack_var_count;
 
-        if (return_value_start != stack.size() - 1)
-            throw std::runtime_error("expected one return value");
+    if (return_value_start != stack.size() - 1)
+        throw std::runtime_error("expected one return value");
 
-        stack.erase(stack.begin() + frame_start, stack.begin() + return_value_start);
-    } else {
-        // remove entire call frame from value stack including any return values
-        clear_call_frame();
-    }
+    stack.erase(stack.begin() + frame_start, stack.begin() + return_value_start);
 
-    instruction_ptr = call_frame_stack.back().return_ptr;
+    instruction_ptr = current_call_frame.return_ptr;
+    const size_t return_call_frame_index = current_call_frame.return_call_frame_index;
     call_frame_stack.pop_back();
+
+    if (!call_frame_stack.empty())
+        set_executing_call_frame(return_call_frame_index);
+    else if (frozen_stack.segment)
+        thaw_frozen_stack();
 }
 
-call_frame& virtual_machine::get_executing_call_frame() {
-    for (auto it = call_frame_stack.rbegin(); it != call_frame_stack.rend(); it++)
-        if (it->executing_lambda)
-            return *it;
+void virtual_machine::set_executing_call_frame(const size_t call_frame_index) {
+    executing_call_frame_index = call_frame_index;
+    stack_vars_begin = call_frame_stack[call_frame_index].frame_index + 1;
+}
+
+void virtual_machine::thaw_frozen_stack() {
+    const auto& segment = *frozen_stack.segment;
+
+    const size_t first_frame = frozen_stack.executing_call_frame_index;
+    const size_t first_value = segment.call_frames[first_frame].frame_index;
+
+    call_frame_stack.insert(
+        call_frame_stack.begin(),
+        segment.call_frames.cbegin() + first_frame,
+        segment.call_frames.cbegin() + frozen_stack.call_frame_count
+    );
+    stack.insert(
+        stack.begin(),
+        segment.values.cbegin() + first_value,
+        segment.values.cbegin() + frozen_stack.value_count
+    );
+
+    const size_t frame_count = frozen_stack.call_frame_count - first_frame;
+    for (size_t i = 0; i < frame_count; i++) {
+        call_frame_stack[i].frame_index -= first_value;
+        call_frame_stack[i].return_call_frame_index -= first_frame;
+    }
+
+    // the copied call frame's caller is now the executing call frame of what's left
+    const size_t return_call_frame_index = segment.call_frames[first_frame].return_call_frame_index;
+    if (first_frame == 0)
+        frozen_stack = segment.parent;
+    else
+        frozen_stack = continuation{frozen_stack.segment, first_frame, first_value, return_call_frame_index};
 
-    throw std::runtime_error("no executing call frame");
+    set_executing_call_frame(0);
+}
+
+void virtual_machine::load_constants(const bytecode& program) {
+    constants.clear();
+    constants.reserve(program.get_constant_count());
+
+    // NOTE: each constant is added as soon as it's made so that it's reachable if the next one
+    // allocates. This also keeps the car and cdr of a pair constant, which are always earlier
+    // constants, alive while the pair is allocated.
+    for (uint32_t i = 0; i < program.get_constant_count(); i++)
+        constants.emplace_back(visit(
+            overload{
+                [this](const hand_rolled_procedure_constant& v) -> stack_value {
+                    return allocate<lambda>(std::vector<stack_value>{}, v.bytecode_offset);
+                },
+                [this](const lambda_constant& v) -> stack_value {
+                    return allocate<lambda>(std::vector<stack_value>{}, v.bytecode_offset);
+                },
+                [this](const pair_constant& v) -> stack_value {
+                    return allocate<pair>(
+                        visit(stack_value_to_scheme_value_visitor, constants[v.car_index]),
+                        visit(stack_value_to_scheme_value_visitor, constants[v.cdr_index])
+                    );
+                },
+                [this](const int64_t& v) -> stack_value {
+                    if (!fits_fixnum(v))
+                        return allocate<bignum>(v);
+
+                    return v;
+                },
+                [](const auto& v) -> stack_value {
+                    return stack_value{v};
+                },
+            },
+            program.get_constant(i)
+        ));
+}
+
+call_frame& virtual_machine::get_executing_call_frame() {
+    return call_frame_stack[executing_call_frame_index];
 }
 
 lambda_ptr& virtual_machine::get_executing_lambda() {
@@ -738,13 +1322,13 @@ std::string virtual_machine::stack_top_to_string() const {
     if (stack.empty())
         throw std::runtime_error("stack empty");
 
-    return std::visit(stack_value_formatter_overload<true>{}, stack.back());
+    return visit(stack_value_formatter_overload<true>{}, stack.back());
 }
 
 std::string virtual_machine::stack_to_string() const {
     std::string str = "[";
     for (const auto& v : stack)
-        str += std::visit(stack_value_formatter_overload<true>{}, v) + ", ";
+        str += visit(stack_value_formatter_overload<true>{}, v) + ", ";
 
     str += "]";
     return str;
@@ -753,3 +1337,69 @@ std::string virtual_machine::stack_to_string() const {
 std::string virtual_machine::to_string() const {
     return std::format("vm stack: {}", stack_to_string());
 }
+
+std::optional<scheme_constant> evaluate_builtin_call(
+    virtual_machine& vm,
+    const builtin_procedure bp,
+    const std::span<const scheme_constant> args
+) {
+    vm.stack.clear();
+    vm.call_frame_stack.clear();
+
+    // Give the builtin the same stack layout and call frame it would've had from a regular call.
+    vm.stack.emplace_back(bp);
+    vm.call_frame_stack.emplace_back(lambda_ptr{}, 0, nullptr);
+
+    try {
+        for (const auto& arg : args)
+            vm.stack.emplace_back(visit(
+                overload{
+                    [&vm](const int64_t& v) -> stack_value {
+                        if (!fits_fixnum(v))
+                            return vm.allocate<bignum>(v);
+
+                        return v;
+                    },
+                    [](const double& v) -> stack_value {
+                        return v;
+                    },
+                    [](const bool& v) -> stack_value {
+                        return v;
+                    },
+                    [](const auto&) -> stack_value {
+                        throw std::runtime_error("unexpected constant type for builtin call");
+                    },
+                },
+                arg
+            ));
+
+        bp(&vm, static_cast<uint32_t>(args.size()));
+    } catch (const std::runtime_error&) {
+        return std::nullopt;
+    }
+
+    return visit(
+        stack_value_overload{
+            [](const int64_t& v) -> std::optional<scheme_constant> {
+                return v;
+            },
+            [](const bignum_ptr& v) -> std::optional<scheme_constant> {
+                // a bignum that fits in an int64 is turned back into a bignum by push_constant
+                if (const auto i = v->to_int64())
+                    return *i;
+
+                return std::nullopt;
+            },
+            [](const double& v) -> std::optional<scheme_constant> {
+                return v;
+            },
+            [](const bool& v) -> std::optional<scheme_constant> {
+                return v;
+            },
+            [](const auto&) -> std::optional<scheme_constant> {
+                return std::nullopt;
+            },
+        },
+        vm.stack.front()
+    );
+}
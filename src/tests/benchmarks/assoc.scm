@@ -0,0 +1,18 @@
+(define table
+  '((alpha . 1) (bravo . 2) (charlie . 3) (delta . 4) (echo . 5) (foxtrot . 6) (golf . 7) (hotel . 8)))
+
+(define lookup
+  (lambda (key alist)
+    (if (eqv? key (car (car alist)))
+      (cdr (car alist))
+      (lookup key (cdr alist)))))
+
+(define run
+  (lambda (n acc)
+    (if (= n 0)
+      acc
+      (run (- n 1) (+ acc (lookup 'hotel table) (lookup 'delta table))))))
+
+(display (run 200000 0))
+(newline)
+;; 2400000
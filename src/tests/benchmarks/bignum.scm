@@ -0,0 +1,17 @@
+(define fact
+  (lambda (n acc)
+    (if (= n 0)
+      acc
+      (fact (- n 1) (* n acc)))))
+
+(define f (fact 3000 1))
+
+(define repeat
+  (lambda (n acc)
+    (if (= n 0)
+      acc
+      (repeat (- n 1) (+ acc (* f f))))))
+
+(display (= (repeat 50 0) (* 50 f f)))
+(newline)
+;; true
@@ -0,0 +1,13 @@
+(define make-adder
+  (lambda (x)
+    (lambda (y) (+ x y))))
+
+(define loop
+  (lambda (n acc)
+    (if (= n 0)
+      acc
+      (loop (- n 1) ((make-adder n) acc)))))
+
+(display (loop 200000 0))
+(newline)
+;; 20000100000
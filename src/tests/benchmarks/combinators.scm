@@ -0,0 +1,17 @@
+(define compose3
+  (lambda (f g h)
+    (lambda (x) (f (g (h x))))))
+
+(define make-linear
+  (lambda (a b c d)
+    (lambda (x) (+ (* a x) b c d))))
+
+(define loop
+  (lambda (n acc)
+    (if (= n 0)
+      acc
+      (loop (- n 1) (+ acc ((compose3 (make-linear 1 n 2 3) (make-linear 2 0 0 n) (make-linear 1 1 n 1)) 1))))))
+
+(display (loop 300000 0))
+(newline)
+;; 180003900000
@@ -0,0 +1,23 @@
+(define check
+  (lambda (x)
+    (call/cc
+      (lambda (return)
+        (if (< x 0)
+          (return 0))
+        x))))
+
+(define loop
+  (lambda (i acc)
+    (if (= i 0)
+      acc
+      (loop (- i 1) (+ acc (check (- i 50000)))))))
+
+(define nest
+  (lambda (n)
+    (if (= n 0)
+      (loop 100000 0)
+      (+ 0 (nest (- n 1))))))
+
+(display (nest 1000))
+(newline)
+;; 1250025000
@@ -0,0 +1,8 @@
+(define fib
+  (lambda (n)
+    (if (< n 2)
+      n
+      (+ (fib (- n 1)) (fib (- n 2))))))
+(display (fib 30))
+(newline)
+;; 832040
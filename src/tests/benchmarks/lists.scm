@@ -0,0 +1,21 @@
+(define build
+  (lambda (n acc)
+    (if (= n 0)
+      acc
+      (build (- n 1) (cons n acc)))))
+
+(define sum
+  (lambda (vals acc)
+    (if (null? vals)
+      acc
+      (sum (cdr vals) (+ acc (car vals))))))
+
+(define repeat
+  (lambda (n acc)
+    (if (= n 0)
+      acc
+      (repeat (- n 1) (+ acc (sum (build 10000 (cdr '(0))) 0))))))
+
+(display (repeat 50 0))
+(newline)
+;; 2500250000
@@ -0,0 +1,17 @@
+(define sum-of-squares
+  (lambda (n)
+    (let loop ((i 0) (acc 0))
+      (if (= i n)
+        acc
+        (loop (+ i 1) (+ acc (* i i)))))))
+
+(define count-multiples
+  (lambda (n k)
+    (do ((i 0 (+ i 1))
+         (j 0 (if (= j (- k 1)) 0 (+ j 1)))
+         (count 0 (if (= j 0) (+ count 1) count)))
+      ((= i n) count))))
+
+(display (+ (sum-of-squares 1000000) (count-multiples 1000000 7)))
+(newline)
+;; 333332833333642858
@@ -0,0 +1,15 @@
+(define sum
+  (lambda (l acc)
+    (if (null? l)
+      acc
+      (sum (cdr l) (+ acc (car l))))))
+
+(define run
+  (lambda (n acc)
+    (if (= n 0)
+      acc
+      (run (- n 1) (+ acc (sum '(1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16) 0))))))
+
+(display (run 200000 0))
+(newline)
+;; 27200000
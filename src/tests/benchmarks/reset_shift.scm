@@ -0,0 +1,15 @@
+(define loop
+  (lambda (i acc)
+    (if (= i 0)
+      acc
+      (loop (- i 1) (+ acc (reset (+ 1 (shift k (k (k 0))))))))))
+
+(define nest
+  (lambda (n)
+    (if (= n 0)
+      (loop 20000 0)
+      (+ 1 (nest (- n 1))))))
+
+(display (nest 1000))
+(newline)
+;; 41000
@@ -0,0 +1,21 @@
+(define build
+  (lambda (n acc)
+    (if (= n 0)
+      acc
+      (build (- n 1) (cons n acc)))))
+
+(define reverse
+  (lambda (l acc)
+    (if (null? l)
+      acc
+      (reverse (cdr l) (cons (car l) acc)))))
+
+(define run
+  (lambda (i total)
+    (if (= i 0)
+      total
+      (run (- i 1) (+ total (car (reverse (build 100000 (cdr '(0))) (cdr '(0)))))))))
+
+(display (run 30 0))
+(newline)
+;; 3000000
@@ -0,0 +1,23 @@
+(define build
+  (lambda (n acc)
+    (if (= n 0)
+      acc
+      (build (- n 1) (cons n acc)))))
+
+(define len
+  (lambda (l acc)
+    (if (null? l)
+      acc
+      (len (cdr l) (+ acc 1)))))
+
+(define vals (build 100000 (cdr '(0))))
+
+(define repeat
+  (lambda (n acc)
+    (if (= n 0)
+      acc
+      (repeat (- n 1) (+ acc (len vals 0))))))
+
+(display (repeat 100 0))
+(newline)
+;; 10000000
@@ -0,0 +1,6 @@
+(define f
+  (lambda (x)
+    (car x)
+    x))
+(f 5)
+;; error: unexpected type for car
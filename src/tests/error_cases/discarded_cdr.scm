@@ -0,0 +1,2 @@
+(cdr 'a)
+;; error: unexpected type for cdr
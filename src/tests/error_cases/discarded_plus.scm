@@ -0,0 +1,4 @@
+(display 1)
+(newline)
+(+ 'a 1)
+;; error: unexpected type for binary op
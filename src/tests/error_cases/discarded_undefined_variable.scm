@@ -0,0 +1,6 @@
+(define f
+  (lambda (x)
+    undefined-variable
+    x))
+(f 5)
+;; error: var name not found: undefined-variable
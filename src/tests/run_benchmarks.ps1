@@ -0,0 +1,55 @@
+# Display usage information
+function Usage {
+    Write-Host "Usage: $(basename $MyInvocation.MyCommand) [-h] [-n iterations] /path/to/ploy /path/to/scheme/programs/dir"
+    Write-Host "Runs every scheme program in the given directory the given number of times (default 10) and prints"
+    Write-Host "the average wall clock time of each program along with the total. The bytecode cache isn't used, so"
+    Write-Host "every run includes compiling the program."
+    Write-Host "Options:"
+    Write-Host "    -h      Display help message and quit."
+    Write-Host "    -n      Number of times to run each program."
+}
+
+# Initialize variables
+$iterations = 10
+$total_ms = 0.0
+
+# Check the first argument
+if ($args[0] -eq '-h') {
+    Usage
+    exit
+}
+elseif ($args[0] -eq '-n') {
+    $iterations = [int]$args[1]
+    $args = $args[2..($args.Length - 1)]  # Remove the -n argument and its value from the list
+}
+
+# Validate input arguments
+if ($args.Length -ne 2) {
+    Write-Host "error: missing arguments"
+    Usage
+    exit 1
+}
+
+$ploy_exe = $args[0]
+$programs_dir = $args[1]
+
+# Time each program
+Get-ChildItem -Path $programs_dir -Filter *.scm | ForEach-Object {
+    $program = $_.FullName
+    $stopwatch = [System.Diagnostics.Stopwatch]::StartNew()
+
+    for ($i = 0; $i -lt $iterations; $i++) {
+        & $ploy_exe --no-cache $program | Out-Null
+        if ($LASTEXITCODE -ne 0) {
+            Write-Host "error: $program returned non-zero status"
+            exit 1
+        }
+    }
+
+    $stopwatch.Stop()
+    $total_ms += $stopwatch.Elapsed.TotalMilliseconds
+
+    Write-Host ("{0,-40} {1,10:N3} ms" -f $_.Name, ($stopwatch.Elapsed.TotalMilliseconds / $iterations))
+}
+
+Write-Host ("{0,-40} {1,10:N3} ms" -f "total", ($total_ms / $iterations))
@@ -0,0 +1,73 @@
+#!/usr/bin/env bash
+
+usage() {
+    cat << EOF
+Usage: $(basename "$0") [-h] [-n iterations] /path/to/ploy /path/to/scheme/programs/dir
+
+Runs every scheme program in the given directory the given number of times (default 10) and prints
+the average wall clock time of each program along with the total. Useful for before/after
+comparisons, e.g. on src/tests/test_cases or src/tests/benchmarks. The bytecode cache isn't used, so
+every run includes compiling the program.
+
+Options:
+    -h      Display help message and quit.
+    -n      Number of times to run each program.
+EOF
+}
+
+iterations=10
+
+while getopts :hn: opt; do
+    case $opt in
+        h)
+            usage
+            exit
+            ;;
+        n)
+            iterations="$OPTARG"
+            ;;
+        \?)
+            echo "error: invalid option -$OPTARG"
+            usage
+            exit 1
+            ;;
+        :)
+            echo "error: missing argument for option -$OPTARG"
+            usage
+            exit 1
+            ;;
+    esac
+done
+
+shift $((OPTIND-1))
+
+if [[ $# -ne 2 ]]; then
+    echo "error: missing arguments"
+    usage
+    exit 1
+fi
+
+ploy_exe="$1"
+programs_dir="$2"
+
+total_ns=0
+
+for program in "$programs_dir"/*.scm; do
+    start_ns=$(date +%s%N)
+
+    for ((i = 0; i < iterations; i++)); do
+        if ! "$ploy_exe" --no-cache "$program" > /dev/null; then
+            echo "error: $program returned non-zero status"
+            exit 1
+        fi
+    done
+
+    elapsed_ns=$(( $(date +%s%N) - start_ns ))
+    total_ns=$(( total_ns + elapsed_ns ))
+
+    awk -v name="$(basename "$program")" -v ns="$elapsed_ns" -v n="$iterations" \
+        'BEGIN { printf "%-40s %10.3f ms\n", name, ns / n / 1000000 }'
+done
+
+awk -v ns="$total_ns" -v n="$iterations" \
+    'BEGIN { printf "%-40s %10.3f ms\n", "total", ns / n / 1000000 }'
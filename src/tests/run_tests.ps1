@@ -32,38 +32,71 @@ if ($args.Length -ne 2) {
 $ploy_exe = $args[0]
 $test_cases_dir = $args[1]
 
+# Run each test case from source (which fills a temporary bytecode cache), from the bytecode cache,
+# and from a bytecode file compiled with --compile-to
+$temp_dir = Join-Path ([System.IO.Path]::GetTempPath()) ([System.IO.Path]::GetRandomFileName())
+New-Item -ItemType Directory -Path $temp_dir | Out-Null
+$env:PLOY_CACHE_DIR = Join-Path $temp_dir "cache"
+
+# Runs ploy with the given args and checks its output against the test case's expected output
+function Check-Output($test_case, $description, $ploy_args) {
+    $test_case_output = & $ploy_exe @ploy_args | Out-String
+
+    if ($LASTEXITCODE -ne 0) {
+        $script:errors_encountered = $true
+        Write-Host "error: test case $test_case ($description) returned non-zero status:`n$test_case_output"
+        return
+    }
+
+    # Expected output (from the comments in the file)
+    $expected_output = (Select-String -Path $test_case -Pattern ';; (.+)' | ForEach-Object { $_.Matches.Groups[1].Value }) | Out-String
+
+    if ($test_case_output -ne $expected_output) {
+        $script:errors_encountered = $true
+        Write-Host "error: test case $test_case ($description) failed:"
+        Write-Host -NoNewline "expected output:`n$expected_output"
+        Write-Host -NoNewline "actual output:`n$test_case_output"
+    }
+}
+
 # Process each test case
-Get-ChildItem -Path $test_cases_dir -Filter *.scm | ForEach-Object {
+$test_cases = Get-ChildItem -Path $test_cases_dir -Filter *.scm
+$test_cases | ForEach-Object {
     $test_case = $_.FullName
 
     if ($disassemble) {
-        & $ploy_exe -d $test_case
+        & $ploy_exe --no-cache -d $test_case
         if ($LASTEXITCODE -ne 0) {
             $errors_encountered = $true
         }
         return
     }
 
-    # Run the test case
-    $test_case_output = & $ploy_exe $test_case | Out-String
+    Check-Output $test_case "source" @($test_case)
+    Check-Output $test_case "cached" @($test_case)
 
+    $compiled_test_case = Join-Path $temp_dir "$($_.BaseName).ployc"
+    & $ploy_exe --compile-to $compiled_test_case $test_case
     if ($LASTEXITCODE -ne 0) {
         $errors_encountered = $true
-        Write-Host "error: test case $test_case returned non-zero status:`n$test_case_output"
+        Write-Host "error: test case $test_case failed to compile"
         return
     }
 
-    # Expected output (from the comments in the file)
-    $expected_output = (Select-String -Path $test_case -Pattern ';; (.+)' | ForEach-Object { $_.Matches.Groups[1].Value }) | Out-String
+    Check-Output $test_case "compiled" @($compiled_test_case)
+}
 
-    if ($test_case_output -ne $expected_output) {
+# The cached runs fall back to compiling if the cache can't be used, so make sure it was
+if (-not $disassemble) {
+    $cached_count = @(Get-ChildItem -Path $env:PLOY_CACHE_DIR -Filter *.ployc -ErrorAction SilentlyContinue).Count
+    if ($cached_count -ne $test_cases.Count) {
         $errors_encountered = $true
-        Write-Host "error: test case $test_case failed:"
-        Write-Host -NoNewline "expected output:`n$expected_output"
-        Write-Host -NoNewline "actual output:`n$test_case_output"
+        Write-Host "error: expected $($test_cases.Count) cached programs but found $cached_count"
     }
 }
 
+Remove-Item -Recurse -Force $temp_dir
+
 # Final check for errors
 if ($errors_encountered) {
     Write-Host "one or more errors has occurred"
@@ -4,6 +4,10 @@ usage() {
     cat << EOF
 Usage: $(basename "$0") [-h|-d] /path/to/ploy /path/to/test/cases/dir
 
+Each test case is run three times: from source (which fills a temporary bytecode cache), from the
+bytecode cache, and from a bytecode file compiled with --compile-to. The output of each run is
+checked.
+
 Options:
     -h      Display help message and quit.
     -d      Skip output checks and show disassembly of all test cases.
@@ -47,30 +51,67 @@ test_cases_dir="$2"
 
 errors_encountered=""
 
-for test_case in "$test_cases_dir"/*.scm; do
-    if [[ -n $disassemble ]]; then
-        "$ploy_exe" -d "$test_case" || errors_encountered="true"
-        continue
-    fi
+temp_dir="$(mktemp -d)"
+trap 'rm -rf "$temp_dir"' EXIT
+export PLOY_CACHE_DIR="$temp_dir/cache"
+
+# usage: check_output test_case description ploy_args...
+check_output() {
+    local test_case="$1"
+    local description="$2"
+    shift 2
 
-    test_case_output="$("$ploy_exe" "$test_case")"
+    local test_case_output
+    test_case_output="$("$ploy_exe" "$@")"
 
     if [[ $? -ne 0 ]]; then
         errors_encountered="true"
-        echo -e "error: test case $test_case returned non-zero status:\n$test_case_output"
-        continue
+        echo -e "error: test case $test_case ($description) returned non-zero status:\n$test_case_output"
+        return
     fi
 
+    local expected_output
     expected_output="$(sed -nr 's/;; (.+)/\1/p' "$test_case")"
 
     if [[ $test_case_output != $expected_output ]]; then
         errors_encountered="true"
-        echo "error: test case $test_case failed:"
+        echo "error: test case $test_case ($description) failed:"
         echo -e "expected output:\n$expected_output"
         echo -e "actual output:\n$test_case_output"
     fi
+}
+
+for test_case in "$test_cases_dir"/*.scm; do
+    if [[ -n $disassemble ]]; then
+        "$ploy_exe" --no-cache -d "$test_case" || errors_encountered="true"
+        continue
+    fi
+
+    check_output "$test_case" "source" "$test_case"
+    check_output "$test_case" "cached" "$test_case"
+
+    compiled_test_case="$temp_dir/$(basename "$test_case" .scm).ployc"
+
+    if ! "$ploy_exe" --compile-to "$compiled_test_case" "$test_case"; then
+        errors_encountered="true"
+        echo "error: test case $test_case failed to compile"
+        continue
+    fi
+
+    check_output "$test_case" "compiled" "$compiled_test_case"
 done
 
+# the cached runs fall back to compiling if the cache can't be used, so make sure it was
+if [[ -z $disassemble ]]; then
+    test_case_count="$(ls "$test_cases_dir"/*.scm | wc -l)"
+    cached_count="$(ls "$PLOY_CACHE_DIR"/*.ployc 2> /dev/null | wc -l)"
+
+    if [[ $cached_count -ne $test_case_count ]]; then
+        errors_encountered="true"
+        echo "error: expected $test_case_count cached programs but found $cached_count"
+    fi
+fi
+
 if [[ -n $errors_encountered ]]; then
     echo "one or more errors has occured"
     exit 1
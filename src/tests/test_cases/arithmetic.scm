@@ -5,3 +5,49 @@
 (display (* (+ -3.2 2) (/ 6.2 2)))
 (newline)
 ;; -3.7200000000000006
+
+(display (- (* 2 3.25) (+ 1 2)))
+(newline)
+;; 3.5
+
+(display (cons (< 1 2) (cons (>= 2.5 3) (cons (= 4 4.0) (cons (> 5 -1) (<= 7 6))))))
+(newline)
+;; (true false true true . false)
+
+(display (+ 9223372036854775807 1))
+(newline)
+(display (* 4294967296 4294967296 -3))
+(newline)
+;; 9223372036854775808
+;; -55340232221128654848
+
+(define fact
+  (lambda (n)
+    (if (= n 0)
+      1
+      (* n (fact (- n 1))))))
+(display (fact 30))
+(newline)
+(display (- (+ (fact 25) 1) (fact 25)))
+(newline)
+(display (/ (fact 30) (fact 28)))
+(newline)
+;; 265252859812191058636308480000000
+;; 1
+;; 870
+
+(define big-square (* (fact 300) (fact 300)))
+(display (cons (= (/ big-square (fact 300)) (fact 300)) (eqv? (fact 25) (* 25 (fact 24)))))
+(newline)
+;; (true . true)
+
+(define seven 7)
+(display (cons (+ seven (* 2 (- 10 7))) (cons (odd? (* 3 5)) (cons (null? (+ 1 2)) (eqv? (+ 1 1) 2)))))
+(newline)
+(display (cons (+ 140737488355327 1) (- -140737488355328 1)))
+(newline)
+(display (cons (/ 1 (+ 2 2.0)) (< 1 (+ 1 1) (* 1 3) (- 5 1))))
+(newline)
+;; (13 true false . true)
+;; (140737488355328 . -140737488355329)
+;; (0.25 . true)
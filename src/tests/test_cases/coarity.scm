@@ -15,3 +15,13 @@
    5))
 (newline)
 ;; 25
+
+(define counter 0)
+(define bump
+  (lambda (n)
+    (set! counter (+ counter n))))
+(bump 2)
+(bump 3)
+(display (if (bump 1) counter))
+(newline)
+;; 6
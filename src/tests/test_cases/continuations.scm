@@ -24,3 +24,118 @@
 ;; 2
 ;; 1
 ;; 0
+
+(define saved #f)
+(define resumes 0)
+(define count-resume
+  (lambda (n)
+    (set! resumes (+ resumes n))
+    resumes))
+(define deep
+  (lambda (n)
+    (if (= n 0)
+      (call/cc
+        (lambda (k)
+          (set! saved k)
+          0))
+      (+ 1 (deep (- n 1))))))
+(display (deep 100))
+(newline)
+(if (< (count-resume 1) 3)
+  (saved resumes))
+;; 100
+;; 101
+;; 102
+
+(define sign-or-zero
+  (lambda (x)
+    (call/cc
+      (lambda (return)
+        (if (< x 0)
+          (return 0))
+        x))))
+(display (cons (sign-or-zero 5) (sign-or-zero -5)))
+(newline)
+;; (5 . 0)
+
+(define saved-inner #f)
+(define saved-inner-calls 0)
+(define count-saved-inner-call
+  (lambda (n)
+    (set! saved-inner-calls (+ saved-inner-calls n))
+    saved-inner-calls))
+(display
+  (call-with-escape-continuation
+    (lambda (k)
+      (+ (call/cc
+           (lambda (c)
+             (set! saved-inner c)
+             1))
+         (k 10)))))
+(newline)
+(if (= (count-saved-inner-call 1) 1)
+  (saved-inner 1)
+  #f)
+;; 10
+;; 10
+
+(display (+ 1 (reset (+ 2 (shift k (k (k 10)))))))
+(newline)
+(display (reset (+ 1 (shift k 5))))
+(newline)
+;; 15
+;; 5
+
+(define sum-to
+  (lambda (n)
+    (if (= n 0)
+      (shift k (+ (k 0) (k 1)))
+      (+ n (sum-to (- n 1))))))
+(display (reset (sum-to 100)))
+(newline)
+;; 10101
+
+(define add-ten (reset (+ 10 (shift k k))))
+(display (add-ten (add-ten 1)))
+(newline)
+;; 21
+
+(define count-down
+  (lambda (n)
+    (if (= n 0)
+      (call/cc
+        (lambda (c)
+          (set! saved c)
+          (shift k (k (k 0)))))
+      (+ 1 (count-down (- n 1))))))
+(display (reset (count-down 50)))
+(newline)
+;; 100
+
+(define twice
+  (lambda (x)
+    (shift f (f (f x)))))
+(display (reset (+ 1 (call/cc (lambda (k) (k (twice 1)))))))
+(newline)
+(display (reset (+ 1 (call/ec (lambda (k) (k (twice 1)))))))
+(newline)
+(display (reset (+ 1 (call/ec (lambda (k) (+ 10 (k (shift f (+ 100 (f 1))))))))))
+(newline)
+;; 2
+;; 3
+;; 102
+
+(define shared-call/cc call/cc)
+(define shared-call/ec call/ec)
+(define make-garbage
+  (lambda (n acc)
+    (if (= n 0)
+      acc
+      (make-garbage (- n 1) (cons n n)))))
+(make-garbage 100000 0)
+(display (eqv? shared-call/cc call/cc))
+(newline)
+(display (+ (shared-call/cc (lambda (k) (k 1))) (shared-call/ec (lambda (k) (k 2)))))
+(newline)
+;; true
+;; 3
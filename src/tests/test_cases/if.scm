@@ -17,3 +17,11 @@
 (display (if (eqv? 1 2) 1 2))
 (newline)
 ;; 2
+
+(display (if (eqv? 'abc (car (cdr '(def abc)))) 1 2))
+(newline)
+;; 1
+
+(display (if (eqv? 'abc 'abcd) 1 2))
+(newline)
+;; 2
@@ -0,0 +1,63 @@
+(display (let ((x 1) (y 2)) (+ x y)))
+(newline)
+;; 3
+
+(display
+  (let loop ((i 0) (acc 0))
+    (if (= i 100000)
+      acc
+      (loop (+ i 1) (+ acc i)))))
+(newline)
+;; 4999950000
+
+(define factorial
+  (lambda (n)
+    (let f ((n n))
+      (if (= n 0)
+        1
+        (* n (f (- n 1)))))))
+
+(display (factorial 25))
+(newline)
+;; 15511210043330985984000000
+
+(define get-loop
+  (lambda (x)
+    (let loop ((k x))
+      (if (> k 3)
+        k
+        loop))))
+
+(display ((get-loop 1) 5))
+(newline)
+;; 5
+
+(display
+  (let loop ((i 0))
+    (define j (* i 2))
+    (if (> j 10)
+      j
+      (loop (+ i 1)))))
+(newline)
+;; 12
+
+(display
+  (do ((i 0 (+ i 1)) (acc 1))
+    ((= i 5) acc)
+    (set! acc (* acc 2))))
+(newline)
+;; 32
+
+(define procs
+  (do ((i 0 (+ i 1)) (ps 1 (cons (lambda (x) (+ x i)) ps)))
+    ((= i 3) ps)))
+
+(display ((car procs) 100))
+(display ((car (cdr procs)) 100))
+(newline)
+;; 102101
+
+(do ((i 0 (+ i 1)))
+  ((= i 3))
+  (display i))
+;; 012
@@ -33,4 +33,16 @@
       (reduce f (f ident (car vals)) (cdr vals)))))
 
 (display (reduce (lambda (x y) (+ x y 1)) 0 '(1 2 3 4 5)))
+(newline)
 ;; 20
+
+(define get-table
+  (lambda (x)
+    '((a . 1) (b 2 3) ('c . 4) (281474976710656 2.5 . d))))
+
+(display (get-table 0))
+(newline)
+;; ((a . 1) (b 2 3) ((quote c) . 4) (281474976710656 2.5 . d))
+
+(display (eqv? (get-table 0) (get-table 1)))
+;; true